@@ -7,6 +7,7 @@
 #include  "simplei2c.h"                         // Need the I2C library to talk to the compass module.
 #include  "robot_defs.h"                        // This will provide global robot & I/O definitions.
 #include  "simpletools.h"                       // Needed for debug print and eeprom management.
+#include  "mytrig.h"                            // Integer atan2.
 
 int gCal_x = 0;                                 // Compass calibration X value.
 int gCal_y = 0;                                 // Compass calibration y value.
@@ -61,10 +62,7 @@ int compass_smplHeading(){
 
   compass_read(&x, &y, &z);                     // Compass vals -> variables
 
-  float fy = (float) y + gCal_y;                // Ints to floats and add in calibration value
-  float fx = (float) x + gCal_x;
-
-  float heading = atan2(fy, fx) * 180.0/PI;     // Calculate heading with floats
+  int heading = iatan2(y + gCal_y, x + gCal_x); // Calibrated heading, no floats needed
      
   heading = heading - 90;                       // Correct for sensor mounting orientation
   if (heading < 0)
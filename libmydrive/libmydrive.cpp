@@ -0,0 +1,42 @@
+/*
+ *  MyDrive test harness.
+ *
+ *  Sends the servo pulses from this cog, counting the wheel encoders
+ *  with its own counters as the motor cog does. Sweeps the head servo,
+ *  runs the wheels slowly forward, and once a second prints the
+ *  encoder counts and the servo frames sent.
+ */
+
+#include  "mydrive.h"
+#include  "robot_defs.h"
+#include  "simpletools.h"
+
+int main(){
+  unsigned int left, right, frames;
+  int   angle = 0, step = 300;
+
+  drive_start();                                // Pulses from this cog
+  FRQA = 1;                                     // Add 1 to count at every rising edge.
+  FRQB = 1;
+  PHSA = PHSB = 0;
+  CTRA = 0x28000000 + ENC_L_PIN;                // Left wheel counter set for positive edges
+  CTRB = 0x28000000 + ENC_R_PIN;                // Right wheel counter set for positive edges
+  drive_speed(WHEEL_L_PIN, 20);                 // Both wheels slowly forward
+  drive_speed(WHEEL_R_PIN, -20);
+  left = right = frames = 0;
+
+  while(1){
+    drive_angle(HEAD_PIN, angle);               // Head sweeps 0 to 180 degrees
+    if(angle + step < 0 || angle + step > 1800)
+      step = -step;
+    angle += step;
+    drive_wait(CNT + CLKFREQ);                  // A second of frames, about 50
+
+    print("L %u (+%u), R %u (+%u), %u frames (+%u)\n",
+          PHSA, PHSA - left, PHSB, PHSB - right,
+          drive_frames(), drive_frames() - frames);
+    left = PHSA;
+    right = PHSB;
+    frames = drive_frames();
+  }
+}
@@ -0,0 +1,129 @@
+/*
+ *  MyDrive - servo pulses sent from the waiting time of one cog.
+ *
+ *  drive_start() takes the servo pins in the calling cog. From then
+ *  on that cog sends a frame every DRIVE_FRAME whenever it waits
+ *  through drive_wait(), or through its own loop of drive_due() and
+ *  drive_step() when it has more to do meanwhile (mymotor polls its
+ *  encoders). The pulses of a frame start together and end shortest
+ *  first, each timed by waitcnt from the CNT the frame started at, so
+ *  the widths are as exact as the servo library's. A frame due while
+ *  the cog is busy starts when it next waits, and the next frame
+ *  DRIVE_FRAME after that; the servos only need one every 25ms or so.
+ *  A wait never returns with a frame half sent, so it may run up to
+ *  DRIVE_MAX over. drive_set(), drive_speed() & drive_angle() take
+ *  the same pins and units as servo_set(), servo_speed() &
+ *  servo_angle() and only write the widths, so any cog may call them.
+ */
+
+#include  "simpletools.h"
+#include  "mydrive.h"
+
+static volatile unsigned int drive_pulse[DRIVE_SERVOS];    // Widths in clocks, 0 for no pulses
+static const int    drive_pin[DRIVE_SERVOS] = {WHEEL_L_PIN, WHEEL_R_PIN, HEAD_PIN};
+static unsigned int drive_width[DRIVE_SERVOS];      // Widths of the frame being sent
+static unsigned int drive_high;                     // Pins still high in this frame
+static unsigned int drive_begin;                    // CNT this frame started at
+static unsigned int drive_next;                     // CNT the next frame is due at
+static volatile unsigned int drive_sent;            // Frames sent
+static int drive_cogID = -1;                        // Sending cog ID, -1 until started
+
+/* Send the servo pulses from the calling cog, call once */
+int drive_start(void){
+  int i;
+
+  for(i = 0; i < DRIVE_SERVOS; i++){
+    OUTA &= ~(1 << drive_pin[i]);                   // Low between pulses
+    DIRA |= 1 << drive_pin[i];
+  }
+  drive_high = 0;
+  drive_next = CNT;
+  drive_cogID = cogid();
+  return drive_cogID;
+}
+
+/* Set a servo pulse in us (0 stops its pulses), returns its slot or -1 */
+int drive_set(int pin, int time){
+  int i;
+
+  for(i = 0; i < DRIVE_SERVOS; i++){
+    if(drive_pin[i] == pin){
+      if(time != 0 && time < DRIVE_MIN) time = DRIVE_MIN;
+      if(time > DRIVE_MAX) time = DRIVE_MAX;
+      drive_pulse[i] = time * (CLKFREQ / 1000000);  // Used from the next frame
+      return i;
+    }
+  }
+  return -1;                                        // Not a driver pin
+}
+
+int drive_speed(int pin, int speed){
+  return drive_set(pin, 1500 + speed);
+}
+
+int drive_angle(int pin, int degreeTenths){
+  return drive_set(pin, 500 + degreeTenths);        // 0.5ms to 2.3ms, as servo_angle()
+}
+
+unsigned int drive_frames(void){
+  return drive_sent;
+}
+
+/* The earlier of until and the next pulse start or end */
+unsigned int drive_due(unsigned int until){
+  unsigned int due = drive_next;
+  int i;
+
+  if(drive_high){
+    due = drive_begin + DRIVE_MAX * (CLKFREQ / 1000000);
+    for(i = 0; i < DRIVE_SERVOS; i++)
+      if((drive_high & (1 << drive_pin[i])) && (int)(drive_begin + drive_width[i] - due) < 0)
+        due = drive_begin + drive_width[i];
+  }
+  return (int)(due - until) < 0 ? due : until;
+}
+
+/* Start a frame or end its pulses if due, returns TRUE while a pulse is high */
+int drive_step(void){
+  unsigned int now = CNT;
+  unsigned int drop = 0, mask;
+  int i;
+
+  if(drive_cogID < 0)
+    return FALSE;                                   // Not started
+  if(drive_high == 0){
+    if((int)(now - drive_next) < 0)
+      return FALSE;                                 // Between frames
+    for(i = 0; i < DRIVE_SERVOS; i++){
+      drive_width[i] = drive_pulse[i];
+      if(drive_width[i])
+        drive_high |= 1 << drive_pin[i];
+    }
+    OUTA |= drive_high;                             // All pulses start together
+    drive_begin = now;
+    drive_next = now + DRIVE_FRAME * (CLKFREQ / 1000000);
+    drive_sent++;
+    return drive_high != 0;
+  }
+  for(i = 0; i < DRIVE_SERVOS; i++){
+    mask = 1 << drive_pin[i];
+    if((drive_high & mask) && (int)(now - drive_begin - drive_width[i]) >= 0)
+      drop |= mask;                                 // Equal widths end together
+  }
+  OUTA &= ~drop;
+  drive_high &= ~drop;
+  return drive_high != 0;
+}
+
+/* Wait until CNT reaches until, sending the frames due meanwhile */
+void drive_wait(unsigned int until){
+  unsigned int next;
+  int sending = FALSE;
+
+  while((int)(until - CNT) > 0 || sending){
+    next = drive_due(sending ? drive_next : until);   // Finish a frame past until
+    if((int)(next - CNT) > 400)                     // A CNT already passed would make waitcnt
+      waitcnt(next);                                //  wait for a whole roll-over.
+    sending = drive_step();
+  }
+}
@@ -0,0 +1,54 @@
+/*
+ *  @file mydrive.h
+ *
+ *  @brief MyDrive - wheel & head servo pulses from the motor cog
+ *
+ *  Sends the left wheel, right wheel and head servo pulses every
+ *  DRIVE_FRAME from the cog that called drive_start(), in the time it
+ *  would otherwise spend waiting, instead of from a cog of their own.
+ *  mymotor's motor cog sends them between the encoder polls it makes
+ *  while it waits for the next control interval, and counts the
+ *  encoders with its own counters as before. So the servo library's
+ *  cog is not started: main, motor, sonar, command & task switcher
+ *  take five of the eight cogs instead of six. Any cog may set a
+ *  pulse. Build mymotor and mysonar with -DDRIVE_COG (and link
+ *  -lmydrive) to use it; the head pulses then need the motor cog
+ *  running.
+ */
+
+#ifndef MYDRIVE_H
+#define MYDRIVE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "robot_defs.h"                     // General robot definitions and I/O pin assignments
+
+/* Required robot_defs.h pin definitions
+ * WHEEL_L_PIN, WHEEL_R_PIN, HEAD_PIN       // Servos, in drive_set() slot order
+ */
+
+#define DRIVE_SERVOS  3                     // Left wheel, right wheel & head
+#define DRIVE_FRAME   20000                 // Servo frame (us)
+#define DRIVE_MIN     400                   // Shortest servo pulse (us)
+#define DRIVE_MAX     2600                  // Longest servo pulse (us)
+
+// Drive function prototypes
+int   drive_start(void);                    // Send the pulses from this cog, returns its ID
+int   drive_set(int pin, int time);         // Servo pulse in us, 0 relaxes it (as servo_set)
+int   drive_speed(int pin, int speed);      // Continuous rotation speed, 1500 + speed us
+int   drive_angle(int pin, int degreeTenths); // Position servo angle, 0 to 1800
+unsigned int drive_frames(void);            // Servo frames sent
+
+/* For the sending cog only */
+unsigned int drive_due(unsigned int until); // CNT of the next pulse change, if before until
+int   drive_step(void);                     // Make the pulse changes due, TRUE while pulses are high
+void  drive_wait(unsigned int until);       // Wait until CNT reaches until, sending pulses
+
+#if defined(__cplusplus)
+}
+#endif
+/* __cplusplus */
+#endif
+/* MYDRIVE_H */
@@ -21,6 +21,63 @@ int motorAction(int action, int dir=0, int value1=0, int value2= 0){
 
 }
 
+/* Queue a motor command and wait (up to 10 seconds) for it to finish */
+int motorRun(int action, int dir=0, int value1=0, int value2=0){
+  mtrCommand.action = action;
+  mtrCommand.direction = dir;
+  mtrCommand.value1 = value1;
+  mtrCommand.value2 = value2;
+  unsigned int seq;
+  while((seq = motorQueue(mtrCommand)) == 0)
+    pause(1);                                        // Queue full, wait for the motor cog
+  int done = motorWait(seq, 10000);
+  if(motorGetFunction() == STALL){                   // A wheel stalled or slipped
+    say("A wheel is stuck.");
+    motorAction(STOP);                               // Clear it so the next command runs
+    done = FALSE;
+  }
+  return(done);
+}
+
+#ifdef MOTOR_BENCH
+/*
+ *  Control math benchmark - build with -DMOTOR_BENCH, then again with
+ *  -DMOTOR_BENCH -DMOTOR_FIXED, and compare the cycle counts.
+ */
+int main(){
+#ifdef MOTOR_FIXED
+  print("Fixed point: %d cycles per control interval\n", motorBench(1000));
+#else
+  print("Float: %d cycles per control interval\n", motorBench(1000));
+#endif
+  return 0;
+}
+#elif defined(MOTOR_LOG)
+/*
+ *  Telemetry log - build with -DMOTOR_LOG, capture the USB port at
+ *  115200 baud while the robot drives out and back, then turn the
+ *  capture into CSV on the host with motorlog.c.
+ */
+int main(){
+  static const int route[3][2] = {{24, 0}, {24, 24}, {0, 0}};      // Inches from here
+  serial *port;
+  unsigned int seq;
+
+  initMotorControl();
+  simpleterm_close();                                // The log has the USB port to itself
+  port = serial_open(USB_RX_PIN, USB_TX_PIN, 0, 115200);
+
+  motorRun(SETPOS, 0, 0, 0);
+  seq = motorFollow(route, 3, 50);
+  while(!motorDone(seq)){
+    motorLogSend(port, MOTOR_LOG_SIZE);              // Drain while the robot drives
+    pause(100);
+  }
+  pause(500);                                        // Let the last intervals in
+  motorLogSend(port, MOTOR_LOG_SIZE);
+  return 0;
+}
+#else
 int main(){
   
   initMotorControl();
@@ -31,6 +88,15 @@ int main(){
   
   voice(8);
   
+  if(!motorHasFeed()){                                  // No feed forward tables saved yet
+    say("Calibrating the wheels.");
+    motorCalibrate();
+  }
+  if(!motorHasGains()){                                 // No tuned gains saved yet
+    say("Tuning the motor gains.");
+    motorTune();
+  }
+
   say("Move Forward, speed at 50% for a few seconds.");
   motorAction(MOVE, FORWARD, 50);
   pause(4000);
@@ -47,127 +113,122 @@ int main(){
   servo_set(WHEEL_R_PIN, 1500);               // Stop the Right wheel
 */
 
-  pause(4000);
   say("Forward, speed at 50% for two inches.");
-  motorAction(MOVE, FORWARD, 50, 2);
-  pause(3000);
+  motorRun(MOVE, FORWARD, 50, 2);
 
+  say("Forward six inches in three steps, without stopping.");
+  mtrCommand.action = MOVE;
+  mtrCommand.direction = FORWARD;
+  mtrCommand.value1 = 50;
+  mtrCommand.value2 = 2;
+  motorQueue(mtrCommand);                            // Queued moves run back to back,
+  motorQueue(mtrCommand);                            //  so only the last needs waiting for.
+  motorWait(motorQueue(mtrCommand), 10000);
+
+  say("Drive a one foot square, without stopping at the corners.");
+  static const int square[4][2] = {{12, 0}, {12, 12}, {0, 12}, {0, 0}};
+  motorRun(SETPOS, 0, 0, 0);                         // Square starts here, facing ahead
+  motorWait(motorFollow(square, 4, 50), 30000);
 
-  pause(2000);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
   
   say("Rotate right ninety degrees.");
-  motorAction(TURN, RIGHT, 90);
+  motorRun(TURN, RIGHT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
   
-  pause(2000);
   say("Rotate right ninety degrees.");
-  motorAction(TURN, RIGHT, 90);
+  motorRun(TURN, RIGHT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
 
-  pause(2000);
   say("Rotate right ninety degrees.");
-  motorAction(TURN, RIGHT, 90);
+  motorRun(TURN, RIGHT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
 
-  pause(2000);
   say("Rotate right ninety degrees.");
-  motorAction(TURN, RIGHT, 90);
+  motorRun(TURN, RIGHT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
 
-  pause(2000);
   say("Rotate left ninety degrees.");
-  motorAction(TURN, LEFT, 90);
+  motorRun(TURN, LEFT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
 
-  pause(2000);
   say("Rotate left ninety degrees.");
-  motorAction(TURN, LEFT, 90);
+  motorRun(TURN, LEFT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
 
-  pause(2000);
   say("Rotate left ninety degrees.");
-  motorAction(TURN, LEFT, 90);
+  motorRun(TURN, LEFT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
 
-  pause(2000);
   say("Rotate left ninety degrees.");
-  motorAction(TURN, LEFT, 90);
+  motorRun(TURN, LEFT, 90);
   say("I'm currently facing,");
   Heading = compass_smplHeading();                   // Get current heading from compass
   sayInt(Heading);                                   // Announce current compass heading
 
-  pause(2000);
   say("Rotate right forty five degrees.");
-  motorAction(TURN, RIGHT, 45);
-  pause(1000);
+  motorRun(TURN, RIGHT, 45);
   say("Rotate right forty five degrees.");
-  motorAction(TURN, RIGHT, 45);
+  motorRun(TURN, RIGHT, 45);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
   
-  pause(2000);
   say("Rotate left forty five degrees.");
-  motorAction(TURN, LEFT, 45);
-  pause(2000);
+  motorRun(TURN, LEFT, 45);
   say("Rotate left forty five degrees.");
-  motorAction(TURN, LEFT, 45);
+  motorRun(TURN, LEFT, 45);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
 
 
-  pause(4000);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
   say("and will now turn North.");
-  motorAction(TURN, FACE, NORTH);                    // Turn to face North (Zero degrees)
+  motorRun(TURN, FACE, NORTH);                       // Turn to face North (Zero degrees)
 
-  pause(4000);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
   say("and will now turn East.");
-  motorAction(TURN, FACE, EAST);                     // Turn to face East (90 degrees)
+  motorRun(TURN, FACE, EAST);                        // Turn to face East (90 degrees)
 
-  pause(4000);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
   say("and will now turn South.");
-  motorAction(TURN, FACE, SOUTH);                    // Turn to face South (180 degrees)
+  motorRun(TURN, FACE, SOUTH);                       // Turn to face South (180 degrees)
   
-  pause(4000);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
   say("and will now turn West.");
-  motorAction(TURN, FACE, WEST);                     // Turn to face West (270 degrees)
+  motorRun(TURN, FACE, WEST);                        // Turn to face West (270 degrees)
 
-  pause(4000);
   Heading = compass_smplHeading();                   // Get current heading from compass
   say("I'm currently facing,");
   sayInt(Heading);                                   // Announce current compass heading
   say("and will now turn North.");
-  motorAction(TURN, FACE, NORTH);                    // Turn to face North (0 degrees)
+  motorRun(TURN, FACE, NORTH);                       // Turn to face North (0 degrees)
 
   return 0;
 }
+#endif
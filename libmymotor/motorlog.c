@@ -0,0 +1,109 @@
+/*
+ *  motorlog - turn a capture of the motor telemetry log into CSV.
+ *
+ *  Host side tool, not part of the Propeller library. Build a robot
+ *  program with -DMOTOR_LOG, capture the serial port motorLogSend()
+ *  writes to, then:
+ *
+ *     cc -I.. -o motorlog motorlog.c
+ *     motorlog [clkfreq] < capture.bin > motorlog.csv
+ *
+ *  Each frame is LOG_SYNC, the 28 bytes of struct motorLog (see
+ *  mymotor.h, little endian) and their 8 bit sum. Bytes that do not
+ *  make a good frame, followed by the next frame or the end of the
+ *  capture, are skipped. Time is in seconds from the first
+ *  frame (clkfreq defaults to 80MHz), velocity and error in clicks
+ *  per CTRL_REF interval, the pose in inches & degrees. Gaps in seq
+ *  (frames the robot dropped or the capture lost) are counted on
+ *  stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "robot_defs.h"
+
+#define LOG_SYNC    0xA5                            // As in mymotor.h
+#define LOG_FIXED   0x01
+#define LOG_BYTES   28                              // sizeof(struct motorLog)
+
+static unsigned int getLong(const unsigned char *b){
+  return(b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int) b[3] << 24));
+}
+
+static int getShort(const unsigned char *b){
+  return((short)(b[0] | (b[1] << 8)));
+}
+
+/* Pose coordinate as inches */
+static double getPos(const unsigned char *b, int flags){
+  unsigned int bits = getLong(b);
+  float f;
+
+  if(flags & LOG_FIXED)
+    return((int) bits / 65536.0);                   // Q16.16
+  memcpy(&f, &bits, sizeof(f));                     // Float bits, host is little endian too
+  return(f);
+}
+
+static const char *funcName(int func){
+  switch(func){
+    case STOP:      return("STOP");
+    case FORWARD:   return("FORWARD");
+    case BACKWARD:  return("BACKWARD");
+    case LEFT:      return("LEFT");
+    case RIGHT:     return("RIGHT");
+    case GOTO:      return("GOTO");
+    case TUNE:      return("TUNE");
+    case FFCAL:     return("FFCAL");
+    case STALL:     return("STALL");
+    default:        return("?");
+  }
+}
+
+int main(int argc, char *argv[]){
+  unsigned char *buf = NULL, *b, sum;
+  double clkfreq = argc > 1 ? atof(argv[1]) : 80000000.0;
+  double time = 0;
+  unsigned int lastCnt = 0;
+  size_t size = 0, len = 0, at;
+  int   i, n = 0, seq, lastSeq = 0, lost = 0, bad = 0;
+
+  do{                                               // Whole capture, it is small
+    if(len == size && (buf = realloc(buf, size += 65536)) == NULL)
+      return(1);
+    len += fread(buf + len, 1, size - len, stdin);
+  } while(!feof(stdin) && !ferror(stdin));
+
+  printf("seq,time,func,vel_l,vel_r,err_l,err_r,power_l,power_r,x,y,heading\n");
+  for(at = 0; at + LOG_BYTES + 2 <= len; at++){
+    if(buf[at] != LOG_SYNC)
+      continue;
+    b = buf + at + 1;
+    for(sum = 0, i = 0; i < LOG_BYTES; i++)
+      sum += b[i];
+    if(sum != b[LOG_BYTES] ||                       // Frames come back to back, so a good one
+       (at + LOG_BYTES + 2 < len && b[LOG_BYTES + 1] != LOG_SYNC)){ //  is followed by the next.
+      bad++;                                        // Not a frame start, or a garbled frame
+      continue;
+    }
+    at += LOG_BYTES + 1;
+    seq = b[26] | (b[27] << 8);
+    if(n > 0){
+      time += (unsigned int)(getLong(b) - lastCnt) / clkfreq;
+      lost += (unsigned short)(seq - lastSeq - 1);
+    }
+    lastCnt = getLong(b);
+    lastSeq = seq;
+    n++;
+    printf("%d,%.3f,%s,%.3f,%.3f,%.3f,%.3f,%d,%d,%.2f,%.2f,%d\n",
+           seq, time, funcName(b[24]),
+           getShort(b + 12) / 16.0, getShort(b + 14) / 16.0,
+           getShort(b + 16) / 16.0, getShort(b + 18) / 16.0,
+           (signed char) b[22], (signed char) b[23],
+           getPos(b + 4, b[25]), getPos(b + 8, b[25]), getShort(b + 20));
+  }
+  fprintf(stderr, "%d frames, %d lost, %d bad\n", n, lost, bad);
+  free(buf);
+  return(0);
+}
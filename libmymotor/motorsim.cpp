@@ -0,0 +1,592 @@
+/*
+ *  motorsim - run the motor controller against a simulated robot.
+ *
+ *  Host side tool, not part of the Propeller library. mymotor.cpp,
+ *  mycompass.cpp and mytrig.cpp are built as they are; the headers in
+ *  sim/ stand in for the Propeller libraries, so the servo pulses
+ *  drive a model of the two wheels, their encoder edges are added to
+ *  PHSA & PHSB and a model magnetometer answers the compass. Reading
+ *  CNT and waitcnt() advance simulated time, so a run takes a few
+ *  milliseconds:
+ *
+ *     c++ -Isim -I.. -I../libmycompass -I../libmytrig -include ../prop_pins.h \
+ *         -o motorsim motorsim.cpp mymotor.cpp ../libmycompass/mycompass.cpp \
+ *         ../libmytrig/mytrig.cpp
+ *     motorsim [options] [move|dist|turn|left|square|restart|jam]
+ *
+ *  Add -DCTRL_INT=40, -DMOTOR_FIXED and so on as for the robot; with
+ *  -DMOTOR_LOG the telemetry log is written to motorsim.bin for
+ *  motorlog. With -DDRIVE_COG (add -I../libmydrive and
+ *  ../libmydrive/mydrive.cpp) the motor cog sends the servo pulses on
+ *  OUTA and the wheels follow the pulse widths there; the longest gap
+ *  between pulses is printed, and one over SERVO_GAP ms FAILs. Options:
+ *
+ *     -p PCT   velocity % (50)            -l GAIN  left wheel gain (0.97)
+ *     -d PCT   servo deadband (5)         -r GAIN  right wheel gain (1.03)
+ *     -t SEC   wheel time constant (0.12) -n DEG   compass noise, +/- (2)
+ *     -m PCT   encoder edges missed (0)   -s SEED  random seed (1)
+ *     -h DEG   compass heading at the start (0)
+ *     -i IN    dist length & square side (DIST_IN)
+ *     -c       run FFCAL and TUNE first
+ *
+ *  move drives forward for MOVE_MS, dist drives -i inches, turn and
+ *  left rotate right and left 90 degrees, and square drives a GOTO
+ *  square with -i inch sides. restart starts a queued move, then after
+ *  a second calls STOP and MOVE directly, as motorStop() & motorMove()
+ *  would; the robot must still be moving RESTART_S later. jam drives
+ *  forward and after JAM_S, plus part of a CTRL_REF interval set by
+ *  the seed, holds the left wheel still; the motor cog must report
+ *  STALL within STALL_TICKS CTRL_REF intervals. The results are
+ *  printed one per line; the pose the robot reports is compared with
+ *  where the model really is, and its total clicks with the encoder
+ *  edges the model made. A turn the wrong way, more than TURN_TOL
+ *  degrees off, a restart that stopped, a jam not caught in time or a
+ *  STALL in any other scenario prints FAIL and exits with 1, so runs
+ *  like
+ *
+ *     motorsim turn && motorsim left && motorsim -h 200 turn && motorsim -h 30 left
+ *
+ *  check that turns are relative to the heading they start from.
+ *
+ *  move reports how its speed settles after the step from rest. The
+ *  profile ramps that step in; to time the speed loop alone build
+ *  with -DMOTOR_ACCEL=2000 -DMOTOR_JERK=40000 (about a step at either
+ *  loop rate) and compare CTRL_INT builds with the same options, e.g.
+ *
+ *     motorsim -l 0.85 -r 1.1 move
+ *
+ *  dist reports its error, time and the peak acceleration along the
+ *  way, stop included. The same step options come close to moves
+ *  without the profile (full speed at once, stop from full speed), e.g.
+ *
+ *     motorsim -p 100 -l 0.95 -r 1.05 -i 12 dist
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <setjmp.h>
+#include "simpletools.h"
+#include "servo.h"
+#include "simplei2c.h"
+#include "robot_defs.h"
+#include "mymotor.h"
+
+#define SIM_STEP      40000                         // Model step in clocks (0.5ms)
+#define SIM_READ      20                            // Clocks each CNT read takes
+#define SIM_LIMIT     60                            // Seconds before a run is given up
+#define MOVE_MS       6000                          // move length
+#define DIST_IN       24                            // dist length & square side (inches)
+#define FIELD         400                           // Magnetometer reading for the earth's field
+#define TURN_TOL      5                             // Degrees a turn may end off by
+#define RESTART_S     2                             // restart runs on this long after the MOVE
+#define JAM_S         2                             // jam drives this long before the wheel jams
+#define JAM_LIMIT     (STALL_TICKS * CTRL_REF / 1000.0)  // Seconds a jam may go without a STALL
+#define FULL_CPS      (CLICKS * V_MAX * 1000 / CTRL_REF) // Clicks per second at full power
+#define SERVO_GAP     25                            // Longest ms a servo may go without a pulse
+
+void  motorControl(void *par);                      // mymotor.cpp, runs in its own cog
+
+volatile unsigned int PHSA, PHSB, FRQA, FRQB, CTRA, CTRB;
+volatile unsigned int OUTA, DIRA;                   // Servo pins (DRIVE_COG)
+unsigned int _clkfreq = 80000000;
+
+struct serial_sim{ FILE *f; };
+
+/* Robot model */
+static double gain[2] = {0.97, 1.03};               // Left/Right wheel gain
+static double deadband = 5;                         // Servo % that does not turn a wheel
+static double tau = 0.12;                           // Wheel time constant (s)
+static double noise = 2;                            // Compass noise (+/- degrees)
+static double missed = 0;                           // Encoder edges lost (%)
+static int    pulse[2];                             // Servo pulse from 1500us, + is forward
+static double vel[2];                               // Wheel speed (clicks/s, + is forward)
+static double travel[2];                            // Clicks turned, either way
+static double edge[2] = {1, 1};                     // Travel at the next encoder edge
+static int    jammed;                               // Left wheel held still
+static double jamAt;                                // Part CTRL_REF the jam comes after JAM_S
+static double xPos, yPos, heading;                  // Pose in inches & degrees (+ = left)
+static double headStart;                            // heading when the run started
+#ifdef DRIVE_COG
+static unsigned int outLast;                        // OUTA at the last look
+static unsigned int rise[2];                        // CNT each wheel's pulse started at
+static unsigned int gapMax;                         // Longest from one pulse start to the next
+#endif
+
+/* Simulation */
+static unsigned int simCnt;                         // CNT
+static unsigned int simPhase;                       // Clocks into the current model step
+static double simTime;                              // Seconds
+static unsigned char eeprom[65536];
+static void (*cogFunc)(void *);
+static jmp_buf simEnd;
+static int    intervals;                            // Compass reads, one per control interval
+static int    inStep;                               // Running the scenario
+
+/* Scenario */
+enum { START, CALIBRATE, RUN, SETTLE };
+static const char *scenario = "move";
+static int    stage = START;
+static int    velocity = 50;
+static int    inches = DIST_IN;
+static int    calibrate = 0;
+static unsigned int seq;
+static double tStart, tDone, tStall, tJam;
+static double tRestart, xRestart;                   // When & where restart moved again
+static int    restartFunc = STOP;                   // mFunc RESTART_S after it
+static double peak, speedSum[2];
+static double accelPeak, lastSpeed;                 // in/s^2, clicks/s
+static int    speedCount;
+static double speedLog[MOVE_MS / 10];
+#ifdef MOTOR_LOG
+static serial *logPort;
+#endif
+
+static double frand(void){
+  return(rand() / (double) RAND_MAX * 2 - 1);       // -1 to 1
+}
+
+/* Wheel speed for a servo pulse, clicks per second */
+static double wheelTarget(int w){
+  double p = abs(pulse[w]) > 100 ? 1.0 : abs(pulse[w]) / 100.0;
+
+  if(p * 100 <= deadband)
+    return(0);
+  p = (p - deadband / 100) / (1 - deadband / 100);
+  return((pulse[w] < 0 ? -p : p) * FULL_CPS * gain[w]);
+}
+
+static void scenarioStep(void);
+
+/* Move the model on SIM_STEP clocks */
+static void modelStep(void){
+  double dt = (double) SIM_STEP / _clkfreq;
+  double dist, rad;
+  int   w;
+
+  for(w = 0; w < 2; w++){
+    vel[w] += (wheelTarget(w) - vel[w]) * dt / tau;
+    if(w == 0 && jammed)
+      vel[w] = 0;
+    travel[w] += fabs(vel[w]) * dt;
+    while(travel[w] >= edge[w]){                    // A hole passed the sensor
+      edge[w] += 1;
+      if(rand() % 10000 >= missed * 100 && (w ? CTRB : CTRA) != 0){
+        if(w) PHSB += FRQB;
+        else  PHSA += FRQA;
+      }
+    }
+  }
+  if(stage >= RUN && fabs((vel[0] + vel[1]) / 2 - lastSpeed) / dt * DIST_PER_CLICK > accelPeak)
+    accelPeak = fabs((vel[0] + vel[1]) / 2 - lastSpeed) / dt * DIST_PER_CLICK;
+  lastSpeed = (vel[0] + vel[1]) / 2;
+  dist = (vel[0] + vel[1]) / 2 * DIST_PER_CLICK * dt;
+  rad = heading * PI / 180;
+  xPos += dist * cos(rad);
+  yPos += dist * sin(rad);
+  heading += (vel[1] - vel[0]) * DEG_PER_CLICK * dt;
+  simTime += dt;
+  if(!inStep){                                      // Other cogs act between model steps
+    inStep = 1;
+    scenarioStep();
+    inStep = 0;
+  }
+}
+
+#ifdef DRIVE_COG
+/* Wheel pulses from the servo pins, as the servos would time them */
+static void pinStep(void){
+  static const int pin[2] = {WHEEL_L_PIN, WHEEL_R_PIN};
+  unsigned int mask, width;
+  int   w;
+
+  for(w = 0; w < 2; w++){
+    mask = 1 << pin[w];
+    if(((OUTA ^ outLast) & mask) == 0 || (DIRA & mask) == 0)
+      continue;
+    if(OUTA & mask){                                // Pulse starts
+      if(rise[w] && simCnt - rise[w] > gapMax)
+        gapMax = simCnt - rise[w];
+      rise[w] = simCnt;
+    } else {                                        // Pulse ends, the servo takes its width
+      width = (simCnt - rise[w] + _clkfreq / 2000000) / (_clkfreq / 1000000);
+      pulse[w] = w ? 1500 - (int) width : (int) width - 1500;
+    }
+  }
+  outLast = OUTA;
+}
+#endif
+
+/* Run the model for some clocks */
+static void advance(unsigned int clocks){
+  unsigned int n;
+
+#ifdef DRIVE_COG
+  pinStep();                                        // Pins written since the last CNT read
+#endif
+  while(clocks){
+    n = SIM_STEP - simPhase;
+    if(n > clocks) n = clocks;
+    simCnt += n;
+    simPhase += n;
+    clocks -= n;
+    if(simPhase == SIM_STEP){
+      simPhase = 0;
+      modelStep();
+    }
+  }
+}
+
+unsigned int sim_cnt(void){
+  advance(SIM_READ);
+  return(simCnt);
+}
+
+void sim_waitcnt(unsigned int until){
+  advance(until - simCnt);                          // A time already passed waits a whole roll-over
+}
+
+void pause(int ms){
+  sim_waitcnt(simCnt + ms * (_clkfreq / 1000));
+}
+
+int cogstart(void (*func)(void *), void *par, void *stack, size_t stacksize){
+  cogFunc = func;                                   // main() runs it
+  return(1);
+}
+
+int cogid(void){
+  return(1);                                        // The motor cog
+}
+
+int servo_set(int pin, int time){
+  if(pin == WHEEL_L_PIN)
+    pulse[0] = time - 1500;
+  else if(pin == WHEEL_R_PIN)
+    pulse[1] = 1500 - time;                         // Mounted the other way round
+  return(0);
+}
+
+int servo_speed(int pin, int speed){
+  return(servo_set(pin, 1500 + speed));
+}
+
+void ee_putByte(unsigned char value, int addr){ eeprom[addr] = value; }
+char ee_getByte(int addr){ return(eeprom[addr]); }
+void ee_putInt(int value, int addr){ memcpy(&eeprom[addr], &value, sizeof(value)); }
+int  ee_getInt(int addr){ int v; memcpy(&v, &eeprom[addr], sizeof(v)); return(v); }
+
+i2c *i2c_newbus(int sclPin, int sdaPin, int sclDrive){
+  return(NULL);
+}
+
+int i2c_out(i2c *bus, int i2cAddr, int memAddr, int memAddrCount,
+            const unsigned char *data, int dataCount){
+  return(dataCount);
+}
+
+/* HMC5883L data registers: X, Z & Y, most significant byte first */
+int i2c_in(i2c *bus, int i2cAddr, int memAddr, int memAddrCount,
+           unsigned char *data, int dataCount){
+  double rad = (90 - heading + noise * frand()) * PI / 180; // Compass turns the other way,
+  short field[3];                                           //  from 90 degrees off the mount.
+  int   i;
+
+  field[0] = (short)(FIELD * cos(rad));
+  field[1] = 0;
+  field[2] = (short)(FIELD * sin(rad));
+  for(i = 0; i < 3 && 2 * i + 1 < dataCount; i++){
+    data[2 * i] = (unsigned short) field[i] >> 8;
+    data[2 * i + 1] = field[i] & 0xFF;
+  }
+  intervals++;
+  return(dataCount);
+}
+
+#ifdef MOTOR_LOG
+serial *serial_open(int rxpin, int txpin, int mode, int baudrate){
+  static struct serial_sim port;
+
+  if(port.f == NULL)
+    port.f = fopen("motorsim.bin", "wb");
+  return(&port);
+}
+
+int serial_txChar(serial *port, int txbyte){
+  if(port->f != NULL)
+    fputc(txbyte, port->f);
+  return(txbyte);
+}
+#endif
+
+static struct cmd_struct command(int action, int direction, int value1, int value2){
+  struct cmd_struct cmd;
+
+  cmd.action = action;
+  cmd.direction = direction;
+  cmd.value1 = value1;
+  cmd.value2 = value2;
+  return(motorCommand(cmd));                        // At once, from this cog
+}
+
+static unsigned int queue(int action, int direction, int value1, int value2){
+  struct cmd_struct cmd;
+
+  cmd.action = action;
+  cmd.direction = direction;
+  cmd.value1 = value1;
+  cmd.value2 = value2;
+  return(motorQueue(cmd));                          // Never more than MOTOR_QUEUE at once
+}
+
+/* Model position in the robot's pose frame, from where the run started facing */
+static void runPose(double *x, double *y){
+  double rad = -headStart * PI / 180;
+
+  *x = xPos * cos(rad) - yPos * sin(rad);
+  *y = xPos * sin(rad) + yPos * cos(rad);
+}
+
+/* Where the robot thinks it is against where it is (inches) */
+static double poseError(void){
+  struct pose p = motorGetPose();
+  double x, y;
+
+  runPose(&x, &y);
+  return(hypot(p.xPos - x, p.yPos - y));
+}
+
+/* Returns 1 if the run failed */
+static int report(void){
+  double elapsed = tDone - tStart;
+  double x, y, turned, feet;
+  double final, settle = 0, settle5 = 0;
+  int   i, fail = 0;
+
+  runPose(&x, &y);
+  turned = heading - headStart;                     // + = left
+  feet = hypot(x, y) / 12;
+
+  printf("scenario: %s at %d%%\n", scenario, velocity);
+  if(tStall > 0)
+    printf("stall: %.2f s\n", tStall - tStart);
+  if(strcmp(scenario, "jam") == 0){
+    if(tStall > 0 && tStall - tJam <= JAM_LIMIT)
+      printf("jam: STALL %.2f s after the wheel jammed\n", tStall - tJam);
+    else{
+      printf("FAIL: no STALL within %.2f s of the jam\n", JAM_LIMIT);
+      fail = 1;
+    }
+  } else if(tStall > 0){
+    printf("FAIL: STALL without a jam\n");
+    fail = 1;
+  }
+#ifdef DRIVE_COG
+  printf("servo: %.1f ms between pulses at most\n", (double) gapMax * 1000 / _clkfreq);
+  if(gapMax == 0 || gapMax > SERVO_GAP * (_clkfreq / 1000)){
+    printf("FAIL: servo pulses more than %d ms apart\n", SERVO_GAP);
+    fail = 1;
+  }
+#endif
+  if(tDone == 0){
+    printf("timeout: %d s\n", SIM_LIMIT);
+    elapsed = simTime - tStart;
+  }
+  if(strcmp(scenario, "move") == 0 && speedCount > 0){
+    final = (speedSum[0] + speedSum[1]) / 2 / speedCount;
+    for(i = 0; i < MOVE_MS / 10; i++){              // Last time outside 10% & 5% of the final speed
+      if(fabs(speedLog[i] - final) > 0.1 * final)
+        settle = (i + 1) / 100.0;
+      if(fabs(speedLog[i] - final) > 0.05 * final)
+        settle5 = (i + 1) / 100.0;
+    }
+    printf("setpoint: %.1f clicks/s (%d clicks per CTRL_REF)\n",  // des_vel_clicks is whole clicks
+           (int)(CLICKS * velocity) * 1000.0 / CTRL_REF, (int)(CLICKS * velocity));
+    printf("speed: %.2f %.2f clicks/s (left right, last second)\n",
+           speedSum[0] / speedCount, speedSum[1] / speedCount);
+    printf("settle: %.2f s (within 10%%), %.2f s (within 5%%)\n", settle, settle5);
+    printf("overshoot: %.1f %%\n", final > 0 ? (peak / final - 1) * 100 : 0.0);
+  }
+  if(strcmp(scenario, "dist") == 0){
+    printf("distance: %.2f in (asked %d, %+.2f in off)\n", x, inches, x - inches);
+    printf("peak acceleration: %.1f in/s^2\n", accelPeak);
+  }
+  if(strcmp(scenario, "turn") == 0 || strcmp(scenario, "left") == 0){
+    if(strcmp(scenario, "turn") == 0)
+      turned = -turned;                             // Asked for right
+    printf("turned: %.1f deg %s (asked 90)\n", turned, scenario[0] == 't' ? "right" : "left");
+    if(turned < 0 || fabs(turned - 90) > TURN_TOL){
+      printf("FAIL: %s\n", turned < 0 ? "turned the wrong way" : "turn not within TURN_TOL");
+      fail = 1;
+    }
+  } else if(strcmp(scenario, "square") != 0)
+    printf("heading drift: %.1f deg, %.2f deg/ft\n", turned, feet > 0 ? turned / feet : 0.0);
+  if(strcmp(scenario, "restart") == 0){
+    printf("restart: %.2f in in %d s after STOP & MOVE\n", xPos - xRestart, RESTART_S);
+    if(restartFunc != FORWARD){
+      printf("FAIL: the MOVE after STOP was dropped\n");
+      fail = 1;
+    }
+  }
+  if(strcmp(scenario, "square") == 0)
+    printf("end: %.2f in from the start\n", hypot(x, y));
+  printf("pose: %.2f %.2f in, reported %.2f in off\n", x, y, poseError());
+  printf("clicks: %llu %llu counted of %.0f %.0f edges (left right)\n",
+         motorGetClicks(0), motorGetClicks(1), edge[0] - 1, edge[1] - 1);
+  printf("time: %.2f s\n", elapsed);
+  return(fail);
+}
+
+/* Commands and measurements, run between model steps as another cog would */
+static void scenarioStep(void){
+  int   w, n;
+
+#ifdef MOTOR_LOG
+  motorLogSend(logPort, MOTOR_LOG_SIZE);
+#endif
+  if(motorGetFunction() == STALL && tStall == 0)
+    tStall = simTime;
+  switch(stage){
+    case START:
+      if(calibrate){
+        queue(FFCAL, 0, 0, 0);
+        seq = queue(TUNE, 0, 0, 0);
+      }
+      stage = CALIBRATE;
+      break;
+
+    case CALIBRATE:
+      if(calibrate && !motorDone(seq))
+        break;
+      xPos = yPos = 0;                              // Measure from here
+      headStart = heading;
+      queue(SETPOS, 0, 0, 0);
+      if(strcmp(scenario, "dist") == 0)
+        seq = queue(MOVE, FORWARD, velocity, inches);
+      else if(strcmp(scenario, "turn") == 0)
+        seq = queue(TURN, RIGHT, 90, 0);
+      else if(strcmp(scenario, "left") == 0)
+        seq = queue(TURN, LEFT, 90, 0);
+      else if(strcmp(scenario, "square") == 0){
+        queue(GOTO, velocity, inches, 0);
+        queue(GOTO, velocity, inches, inches);
+        queue(GOTO, velocity, 0, inches);
+        seq = queue(GOTO, velocity, 0, 0);
+      } else
+        seq = queue(MOVE, FORWARD, velocity, 0);
+      tStart = simTime;
+      stage = RUN;
+      break;
+
+    case RUN:
+      if(strcmp(scenario, "restart") == 0){
+        if(tRestart == 0 && simTime - tStart >= 1){
+          command(STOP, 0, 0, 0);                   // motorStop(); motorMove() in one go
+          command(MOVE, FORWARD, velocity, 0);
+          tRestart = simTime;
+          xRestart = xPos;
+        } else if(tRestart > 0 && simTime - tRestart >= RESTART_S){
+          restartFunc = motorGetFunction();
+          command(STOP, 0, 0, 0);
+          tDone = simTime;
+          stage = SETTLE;
+        }
+        break;
+      }
+      if(strcmp(scenario, "jam") == 0){
+        if(tJam == 0 && simTime - tStart >= JAM_S + jamAt){
+          jammed = 1;
+          tJam = simTime;
+        } else if(tJam > 0 && (tStall > 0 || simTime - tJam >= 2 * JAM_LIMIT)){
+          command(STOP, 0, 0, 0);
+          tDone = simTime;
+          stage = SETTLE;
+        }
+        break;
+      }
+      if(strcmp(scenario, "move") == 0){
+        n = (int)((simTime - tStart) * 100);        // Every 10ms
+        if(n < MOVE_MS / 10 && (simTime - tStart) * 100 - n < (double) SIM_STEP / _clkfreq * 100){
+          speedLog[n] = (vel[0] + vel[1]) / 2;
+          if(speedLog[n] > peak)
+            peak = speedLog[n];
+          if(n >= MOVE_MS / 10 - 100){
+            for(w = 0; w < 2; w++)
+              speedSum[w] += vel[w];
+            speedCount++;
+          }
+        }
+        if(simTime - tStart >= MOVE_MS / 1000.0)
+          seq = queue(STOP, 0, 0, 0);               // An open move is done once it starts
+        else
+          break;
+      }
+      if(motorDone(seq)){
+        tDone = simTime;
+        stage = SETTLE;
+      }
+      if(simTime - tStart > SIM_LIMIT)
+        longjmp(simEnd, 1);
+      break;
+
+    case SETTLE:
+      if(simTime - tDone >= 0.5)                    // Coast to a stop
+        longjmp(simEnd, 1);
+      break;
+  }
+}
+
+int main(int argc, char *argv[]){
+  clock_t wall = clock();
+  double  secs;
+  int     i, fail;
+
+  for(i = 1; i < argc; i++){
+    if(argv[i][0] != '-'){
+      scenario = argv[i];
+      continue;
+    }
+    if(argv[i][1] == 'c'){
+      calibrate = 1;
+      continue;
+    }
+    if(i + 1 >= argc)
+      break;
+    switch(argv[i][1]){
+      case 'p': velocity = atoi(argv[++i]); break;
+      case 'l': gain[0] = atof(argv[++i]); break;
+      case 'r': gain[1] = atof(argv[++i]); break;
+      case 'd': deadband = atof(argv[++i]); break;
+      case 't': tau = atof(argv[++i]); break;
+      case 'n': noise = atof(argv[++i]); break;
+      case 'm': missed = atof(argv[++i]); break;
+      case 's': srand(atoi(argv[++i])); break;
+      case 'h': heading = -atof(argv[++i]); break;  // Compass turns the other way
+      case 'i': inches = atoi(argv[++i]); break;
+      default:
+        fprintf(stderr, "motorsim: unknown option %s\n", argv[i]);
+        return(1);
+    }
+  }
+  if(strcmp(scenario, "move") && strcmp(scenario, "dist") && strcmp(scenario, "turn") &&
+     strcmp(scenario, "left") && strcmp(scenario, "square") && strcmp(scenario, "restart") &&
+     strcmp(scenario, "jam")){
+    fprintf(stderr, "motorsim: scenarios are move, dist, turn, left, square, restart & jam\n");
+    return(1);
+  }
+
+#ifdef MOTOR_LOG
+  logPort = serial_open(0, 0, 0, 115200);
+#endif
+  jamAt = (frand() + 1) / 2 * CTRL_REF / 1000.0;   // Jam anywhere between edges & intervals
+  initMotorControl();
+  if(setjmp(simEnd) == 0)
+    cogFunc(NULL);                                  // Motor cog, until the scenario ends
+  fail = report();
+  secs = (double)(clock() - wall) / CLOCKS_PER_SEC;
+  printf("intervals: %d in %.1f s simulated, %.0f per second of host time\n",
+         intervals, simTime, secs > 0 ? intervals / secs : 0.0);
+  return(fail);
+}
@@ -12,12 +12,20 @@
  *   updated by Paul Bammel December 2014   // Code clean-up and optimizations.
  *   updated by Paul Bammel January 2015    // Added Derivative code for smoother motor responses.
  *                                          // Also added Dead Reckoning global position tracking.
+ *                                          // Optional Q16.16 fixed point control path (MOTOR_FIXED).
+ *                                          // Optional high rate loop with edge timed velocity.
  *
  */
 
 #include "simpletools.h"                    // General propeller & C++ functions
 #include "servo.h"                          // Control up to 14 servos in another core
+#ifdef DRIVE_COG
+#include "mydrive.h"                        // Servo pulses sent by the motor cog instead
+#define servo_set     drive_set             // Same pins & units as the servo library
+#define servo_speed   drive_speed
+#endif
 #include "mycompass.h"                      // HMC5883L 3-Axis compass module functions
+#include "mytrig.h"                         // Lookup table sine & cosine
 #include "robot_defs.h"                     // General robot definitions and I/O pin assignments
 #include "mymotor.h"                        // Header file for this pimotor.cpp file
 
@@ -26,7 +34,204 @@ void  set_servo(int vel, int motor_index);  // Set the speed of a single servo (
 void  motorControl(void *par);              // Provide motor funtions, runs in its own cog
 float get_velClicks(int motor_index);       // Returns number of encoder "clicks" since last pass.
 void  init_encoders(void);                  // Initialize encoders to count velocity in "clicks".
+static int isqrt(unsigned int n);           // Integer square root
+static void ffLine(void);                   // Default feed forward tables
+static void encSync(void);                  // Count encoder clicks on from here
+static void addClicks(int w, unsigned int clicks); // Add to a wheel's total clicks
+static struct cmd_struct runCommand(struct cmd_struct cmdRequest); // Carry out a direct or queued command
 
+/*
+ *  The encoder counters run free and are never cleared once started:
+ *  clicks are the unsigned difference from the count last used, which
+ *  survives wrap, so an edge landing between a read and the next one
+ *  is counted in the next interval instead of lost.
+ */
+#define ENC_COUNT(w)  ((w) ? PHSB : PHSA)   // Edges counted by this cog's counters
+static unsigned int encLast[2];             // Counts at the last get_velClicks()
+
+/*
+ *  With -DDRIVE_COG the motor cog sends the servo pulses itself while
+ *  it waits (see mydrive.h): every wait wakes for the next pulse start
+ *  or end as well, and runs on until a frame it started is sent.
+ */
+#ifdef DRIVE_COG
+#define DRIVE_DUE(t)  drive_due(t)          // The earlier of t and the next pulse change
+#define DRIVE_STEP()  drive_step()          // Pulse changes due, TRUE while pulses are high
+#else
+#define DRIVE_DUE(t)  (t)
+#define DRIVE_STEP()  FALSE
+#endif
+
+/*
+ *  Edge timed velocity, and the high rate control loop (build with
+ *  CTRL_INT below CTRL_REF, e.g. -DCTRL_INT=40). A few clicks per
+ *  interval is too coarse to control on, even at CTRL_REF: 4 clicks
+ *  at half speed leave the loop hunting a click either side. So the
+ *  loop timestamps encoder edges while it waits between intervals
+ *  and measures velocity as edges over the time between the first
+ *  and last of them (falling back to the edge count while the wheel
+ *  starts). Velocities are kept in 1/VEL_SCALE clicks per CTRL_REF
+ *  interval so CLICKS and the gains keep their meaning, and the
+ *  per-interval gains are scaled so the controller responds at the
+ *  same rate per second as the 250ms loop. Only a loop slower than
+ *  CTRL_REF just counts clicks.
+ */
+#if CTRL_INT <= CTRL_REF
+#define CTRL_FAST
+#define VEL_SCALE     16                            // Velocity resolution, 1/16 click
+#define KP_STEP(k)    ((k) * CTRL_INT / CTRL_REF)
+#define KI_STEP(k)    ((k) * CTRL_INT * CTRL_INT / CTRL_REF / CTRL_REF)
+
+struct  encTrack{
+  unsigned int  seen;                               // Counter value at the last poll
+  unsigned int  edgeTime;                           // CNT at the poll that saw the last edge
+  unsigned int  tickSeen;                           // Counter value at the last control tick
+  unsigned int  prevSeen;                           // Counter value at the previous timed edge
+  unsigned int  prevTime;                           // CNT of the previous timed edge
+  int           timed;                              // prevTime is valid
+  int           vel;                                // Last velocity estimate
+};
+
+static struct encTrack  enc[2];                     // Left & Right encoder tracking
+
+static void pollEdges(void);                        // Timestamp new encoder edges
+static void waitEdges(unsigned int until);          // Wait, timestamping edges
+static int  tickEncoder(int w, int *vel);           // Clicks & velocity for one interval
+#else
+#define VEL_SCALE     1
+#define KP_STEP(k)    (k)
+#define KI_STEP(k)    (k)
+#endif
+#define KD_STEP(k)    (k)
+
+/*
+ *  Gain tuning (TUNE). Both wheels are stepped to TUNE_POWER and
+ *  every encoder edge is timed. Once a wheel is up to speed its count
+ *  follows the line v * (t - tau): the slope against the CLICKS the
+ *  gains were written for gives the wheel's gain g, and where the
+ *  line crosses zero gives its time constant tau. The loop sees a
+ *  speed about an interval late, so the wheel is taken as a lag of
+ *  tau + CTRL_INT. The power update is an integral of the velocity
+ *  error (K_PRO) less velocity feedback (K_DRV), which with that
+ *  model puts the closed loop poles at
+ *
+ *     wn^2 = g * K_PRO / (lag * CTRL_REF)
+ *     2 * zeta * wn * lag = 1 + g * K_DRV
+ *
+ *  Both gains are solved for TUNE_ZETA damping (above 1, as the lag
+ *  only stands in for the delay) and wn = TUNE_SPEED / lag. So K_PRO
+ *  follows the wheels' gain and lag, K_DRV comes out as
+ *  (2 * TUNE_ZETA * TUNE_SPEED - 1) / g, following their gain, and
+ *  K_INT keeps its ratio to K_PRO. Gains are kept in 1/1000 as K_PRO,
+ *  K_INT and K_DRV would be, none above GAIN_MAX.
+ */
+#define TUNE_ZETA     1.3                           // Closed loop damping
+#define TUNE_SPEED    0.5                           // Closed loop natural frequency * lag
+#define GAIN_MAX      4000                          // Largest gain (1/1000) TUNE or EEPROM may set
+#define TUNE_EDGES    10                            // Fewest timed edges to trust a wheel
+#define TUNE_ID       'M'                           // EEPROM mark for saved gains
+
+/*
+ *  Feed forward (FFCAL). Servos have a deadband and the wheels do not
+ *  match, so rather than take 1/CLICKS percent per click, the servo
+ *  power for a wheel setpoint is looked up in a table of the clicks
+ *  each wheel actually made at every FF_STEP percent, forward and
+ *  backward. The PID then only corrects around it. Until FFCAL has
+ *  been run the tables hold the straight CLICKS line.
+ *  Table velocities are in profile units (1/PROF_SCALE clicks).
+ */
+#define FF_HALF       10                            // Table steps from stopped to V_MAX
+#define FF_STEP       (V_MAX / FF_HALF)             // Servo % per table step
+#define FF_SETTLE     200                           // ms to reach each step's speed
+#define FF_MS         300                           // ms to time each step's edges over
+#define FF_MIN        ((int)(CLICKS * V_MAX * PROF_SCALE / 4)) // Fewest clicks at full power
+#define FF_ID         'F'                           // EEPROM mark for a saved table
+#define FF_ENTRY(w, d, k) (((w) * 2 + (d)) * (FF_HALF + 1) + (k)) // EEPROM int for a table entry
+
+struct  edgeSpan{
+  unsigned int  count;                              // Clicks over the whole time
+  unsigned int  n1, t1;                             // Count & CNT from the start at the first timed edge
+  unsigned int  n2, t2;                             // and at the last.
+};
+
+/*
+ *  Motion profile. The PID setpoint follows des_vel_clicks with
+ *  limited acceleration and jerk, and on a distance move it slows
+ *  along the braking curve v^2 = 2 * a * distance left, so the
+ *  robot arrives at MOTOR_CREEP instead of stopping from full speed.
+ *  Profile velocities are in 1/PROF_SCALE clicks per CTRL_REF interval.
+ */
+#define PROF_SCALE    64
+#define PROF_ACCEL    ((int)(MOTOR_ACCEL * CLICKS * PROF_SCALE))  // Per second
+#define PROF_JERK     ((int)(MOTOR_JERK * CLICKS * PROF_SCALE))   // Per second per second
+#define PROF_CREEP    ((int)(MOTOR_CREEP * CLICKS * PROF_SCALE))
+#define PROF_BRAKE    (2 * PROF_ACCEL * CTRL_REF / 1000)          // v^2 per profile unit of distance
+#define PROF_RAMP     (500 * MOTOR_ACCEL / MOTOR_JERK)            // ms of braking lost to the jerk limit
+#define PROF_NEAR     100                                         // Inches, past any braking distance
+
+/*
+ *  Waypoint following (GOTO) by pure pursuit. Each interval the
+ *  robot steers along the arc through a point PATH_LOOK inches
+ *  further along the line from the last waypoint to the next one,
+ *  by driving one wheel faster than the other. Within PATH_LOOK of
+ *  a waypoint it moves on to the next queued GOTO, so the route's
+ *  corners are cut rather than stopped at and turned in place.
+ *  Route positions are in 1/PATH_SCALE inch.
+ */
+#define PATH_SCALE    16
+#define PATH_TRACK    ((int)(DIST_PER_CLICK * 180 / PI / DEG_PER_CLICK * PATH_SCALE)) // Wheel spacing
+#define PATH_NUM(d)   (TO_NUM(d) / PATH_SCALE)                    // Route units to inches
+
+/*
+ *  Stall and slip detection. While driving, each wheel's velocity is
+ *  checked against what the feed forward table says its servo power
+ *  should make: a wheel jammed against something shows power but
+ *  hardly any clicks. A wheel that spins without moving the robot is
+ *  caught by the compass instead, which stops agreeing with the turn
+ *  the wheel clicks say was made. Either one for two CTRL_REF
+ *  intervals stops the wheels, drops the queued commands and leaves
+ *  mFunc at STALL until the next command. With edge timed velocity a
+ *  wheel that was running at its last edge is not given two more
+ *  intervals: once it has gone STALL_GAP expected clicks and
+ *  STALL_GAP_MS without an edge it has jammed, and is reported
+ *  within two intervals of the jam. A wheel too slow to check
+ *  also clears the slip sum, as a hard turn makes the wheel clicks
+ *  too coarse against the compass.
+ */
+#if CTRL_INT < STALL_TICKS * CTRL_REF
+#define STALL_COUNT   (STALL_TICKS * CTRL_REF / CTRL_INT)         // Intervals, at any CTRL_INT
+#else
+#define STALL_COUNT   1
+#endif
+#define SLIP_CLICK    ((int)(DEG_PER_CLICK * 16))                 // 1/16 degrees turned per click
+#define STALL_GAP_MS  (STALL_TICKS * CTRL_REF - CTRL_INT)         // Longest edge gap still reported in time
+
+#ifdef MOTOR_FIXED
+/*
+ *  Q16.16 fixed point control path (build with -DMOTOR_FIXED).
+ *  The Propeller has no floating point hardware, so each float
+ *  operation in the control loop is a library call. Here the gains
+ *  are folded with 1/CLICKS at compile time and every per-interval
+ *  calculation is 32 bit integer math.
+ */
+typedef int   mnum;                                 // Q16.16 value
+#define FIX_ONE       65536
+#define FIX(x)        ((mnum)((x) * FIX_ONE + ((x) < 0 ? -0.5 : 0.5)))
+#define FIX_UP(x)     ((mnum)((x) * FIX_ONE) + 1)   // Rounded up, so whole results stay whole
+#define FIX_INT(x)    ((x) / FIX_ONE)               // Truncates toward zero like a float to int cast
+#define TO_NUM(i)     ((mnum)(i) * FIX_ONE)
+#define CLICKS_OF(v)  FIX_INT(FIX_UP(CLICKS) * (v)) // Percent velocity to clicks/interval
+#define GAIN_OF(k)    FIX((k) / CLICKS)             // Gains in servo percent per click
+#define DIST_HALF     FIX(0.5 * DIST_PER_CLICK)     // Inches per click, averaged over both wheels
+#define DEG_CLICK     FIX(DEG_PER_CLICK)            // Relative heading degrees per click
+#define PROF_DIST(x)  FIX_INT((x) * (int)(PROF_SCALE / DIST_PER_CLICK)) // Inches to profile units
+#else
+typedef float mnum;
+#define TO_NUM(i)     ((float)(i))
+#define CLICKS_OF(v)  (CLICKS * (v))
+#define GAIN_OF(k)    ((float)(k))
+#define PROF_DIST(x)  ((int)((x) * (PROF_SCALE / DIST_PER_CLICK)))
+#endif
 
 // Stack space for Speed Control cog
 unsigned int mymtr_stack[(160 + (50 * 4))];
@@ -38,163 +243,1143 @@ static volatile unsigned char mMode       = 0x07;     // Motor Control Mode (Def
 
 static volatile int     des_vel_clicks    = 0.0;      // Desired velocity in clicks/interval
 static volatile int     des_bias_clicks   = 0.0;      // Desired bias in clicks/interval
-static volatile float   desInchDist       = 0.0;      // Desired distance in inches. Zero = ignore.
-static volatile float   curInchDist       = 0.0;      // Cumulative distance traveled in inches
+static volatile int     profVel           = 0;        // Profiled velocity (PROF_SCALE clicks)
+static volatile int     profAcc           = 0;        // Profiled acceleration (per second)
+static int              setVel            = 0;        // PID velocity setpoint (VEL_SCALE clicks)
+static int              setLast           = 0;        // Setpoint at the previous interval
+static int              setSteer          = 0;        // Right minus left wheel setpoint, halved
+static int              steerLast         = 0;        // Steering at the previous interval
+static volatile int     pathFromX         = 0;        // Waypoint driven from (1/PATH_SCALE inch)
+static volatile int     pathFromY         = 0;
+static volatile int     pathToX           = 0;        // Waypoint driven to
+static volatile int     pathToY           = 0;
+static mnum             pathLeft          = 0;        // Distance left to the last queued waypoint
+static int              pathCap           = 0;        // Speed the outer wheel can keep up on this arc
+static volatile mnum    desInchDist       = 0.0;      // Desired distance in inches. Zero = ignore.
+static volatile mnum    curInchDist       = 0.0;      // Cumulative distance traveled in inches
                                                       //  used when moving fwd/bkwd a fixed distance.
+#ifdef MOTOR_FIXED
+static volatile int     integral          = 0;        // Integral of velocity difference between servos
+static int              integralMax       = 0x3FFFFFFF / GAIN_OF(KI_STEP(K_INT)); // Keeps kiGain * integral
+                                                      //  within 32 bits.
+static volatile mnum    gpsX              = 0;        // Q16.16 copies of gps.xPos & gps.yPos
+static volatile mnum    gpsY              = 0;
+#else
 static volatile float   integral          = 0.0;      // Integral of velocity difference between servos
+#endif
+static mnum             kpGain            = GAIN_OF(KP_STEP(K_PRO)); // Per interval gains, in servo
+static mnum             kiGain            = GAIN_OF(KI_STEP(K_INT)); //  percent per click when fixed
+static mnum             kdGain            = GAIN_OF(KD_STEP(K_DRV)); //  point.
+static volatile int     tuneResult        = 0;        // PASS or FAIL from the last TUNE
+static int              gainSet[3]        = {(int)(K_PRO * 1000), (int)(K_INT * 1000), (int)(K_DRV * 1000)};
+static int              ffVel[2][2][FF_HALF + 1];     // Left/Right, Forward/Backward wheel
+                                                      //  velocity at each FF_STEP of power
+static volatile int     ffResult          = 0;        // PASS or FAIL from the last FFCAL
+static int              stallCount        = 0;        // Intervals a wheel has been stalled
+static int              slipSum           = 0;        // Wheel less compass turn, smoothed (1/16 deg)
+static int              stallHeading      = 0;        // Compass heading at the last stall check
+static int              stallVel[2]       = {0, 0};   // Wheel velocity at its last edge (VEL_SCALE clicks)
+static mnum             powerRest[2]      = {0, 0};   // Power steps too small to take yet (1/CLICKS when fixed)
+static int              leftLast          = 0;        // Previous Left & Right velocity (VEL_SCALE clicks)
+static int              rightLast         = 0;
+#ifdef CTRL_FAST
+static int              powerFine[2]      = {0, 0};   // Servo power in 1/VEL_SCALE percent
+#define POWER         powerFine                       // Small per interval steps must add up
+#else
+#define POWER         mPower
+#endif
+#define POWER_MAX     (V_MAX * VEL_SCALE)
 static volatile int     curHeading        = 0;        // Current compass heading
 static volatile int     desHeading        = 0;        // Desired (new) compass heading
 static volatile int     orgHeading        = 0;        // Compass heading when origin was set.
 
 struct  pose  gps;                                    // Robot's global position
                                                       //  relative to starting (origin).
+static volatile unsigned int poseSeq      = 0;        // Even while gps is stable, odd while written
+static volatile int     setPosReq         = 0;        // SETPOS waiting for the motor cog
+static volatile int     setPosX           = 0;        // Position requested by SETPOS
+static volatile int     setPosY           = 0;
+
+static struct cmd_struct motorQ[MOTOR_QUEUE];         // Queued motion commands
+static volatile unsigned int qHead        = 0;        // Commands queued (caller only)
+static volatile unsigned int qTail        = 0;        // Commands started (motor cog only)
+static volatile unsigned int doneSeq      = 0;        // Last queued command completed
+static unsigned int     runSeq            = 0;        // Queued move or turn under way, else 0
+static unsigned int     openSeq           = 0;        // Queued move without a distance, else 0
+static volatile unsigned int flushTo      = 0;        // qHead at the last STOP
+static volatile unsigned int flushReq     = 0;        // STOP requests made
+static unsigned int     flushSeen         = 0;        // STOP requests handled
+static volatile unsigned int directSeq    = 0;        // Direct motion commands made (caller only)
+static volatile unsigned int flushDirect  = 0;        // directSeq at the last STOP
+
+/*
+ *  gps is written only by the motor cog, between two increments of
+ *  poseSeq. Readers copy it and retry if poseSeq was odd or moved on,
+ *  so they never wait on a pause() and never see half an update.
+ *  The barrier keeps the compiler from moving gps accesses across
+ *  the poseSeq updates.
+ */
+#define POSE_BARRIER()  __asm__ volatile ("" : : : "memory")
+#define QUEUE_BARRIER() POSE_BARRIER()
+
+static void poseWriteBegin(void){
+  poseSeq++;
+  POSE_BARRIER();
+}
+
+static void poseWriteEnd(void){
+  POSE_BARRIER();
+  poseSeq++;
+}
+
+/* Consistent copy of the pose */
+static void poseRead(struct pose *p){
+  unsigned int seq;
+
+  do{
+    while((seq = poseSeq) & 1);                       // Update under way, a few microseconds
+    POSE_BARRIER();
+    *p = gps;
+    POSE_BARRIER();
+  } while(seq != poseSeq);
+}
+
+/*
+ *  Total clicks per wheel since the encoders started, either way,
+ *  all the distance each wheel has rolled. 64 bits are two hub longs,
+ *  so they are written between increments of totalSeq like the pose.
+ */
+static volatile unsigned int totalSeq     = 0;        // Even while encTotal is stable
+static unsigned long long    encTotal[2]  = {0, 0};   // Left & Right clicks counted
+
+static void addClicks(int w, unsigned int clicks){
+  totalSeq++;
+  POSE_BARRIER();
+  encTotal[w] += clicks;
+  POSE_BARRIER();
+  totalSeq++;
+}
+
+/*
+ *  Command queue. One cog queues commands and the motor cog starts
+ *  each one when the one before it is finished, so moves and turns
+ *  follow each other without the caller timing them. Entry n (from
+ *  1) has sequence number n; doneSeq counts the entries finished.
+ *  Like the mymtos mailboxes, the caller alone writes qHead and the
+ *  motor cog alone writes qTail, so no lock is needed.
+ */
+
+/* Distance of queued moves or waypoints that carry on the current one (motor cog only) */
+static mnum queuedDist(void){
+  unsigned int  head = qHead;
+  unsigned int  i;
+  int   x = pathToX, y = pathToY, dx, dy;
+  mnum  dist = 0;
+
+  QUEUE_BARRIER();
+  for(i = qTail; i != head; i++){
+    struct cmd_struct *cmd = &motorQ[i & (MOTOR_QUEUE - 1)];
+    if(cmd->action == BIAS || cmd->action == MODE || cmd->action == SETPOS)
+      continue;                                                   // These don't stop the robot
+    if(mFunc == GOTO && cmd->action == GOTO){                     // Next leg of the route
+      dx = cmd->value1 * PATH_SCALE - x;
+      dy = cmd->value2 * PATH_SCALE - y;
+      dist += PATH_NUM(isqrt(dx * dx + dy * dy));
+      x += dx;
+      y += dy;
+      continue;
+    }
+    if(cmd->action != MOVE || cmd->direction != mFunc || cmd->value2 <= 0)
+      break;
+    dist += TO_NUM(cmd->value2);
+  }
+  return(dist);
+}
+
+/*
+ *  Start the next queued command (motor cog only).
+ *  The running entry, if any, is finished. Entries that take effect
+ *  at once (BIAS, MODE, SETPOS, STOP or a MOVE without a distance)
+ *  finish as they start, and the next one follows in the same
+ *  interval. Returns TRUE if a move or turn was started.
+ */
+static int queueNext(void){
+  struct cmd_struct cmd;
+  unsigned int tail = qTail;
+
+  if(runSeq)
+    doneSeq = runSeq;
+  runSeq = openSeq = 0;
+  while(qHead != tail){
+    QUEUE_BARRIER();
+    cmd = motorQ[tail & (MOTOR_QUEUE - 1)];
+    QUEUE_BARRIER();                                              // Slot is copied out before the
+    qTail = ++tail;                                               //  caller may reuse it.
+    if(cmd.action == STOP)
+      mFunc = STOP;                                               // Stop without a flush
+    else
+      runCommand(cmd);
+    if((cmd.action == MOVE && cmd.value2 > 0) || cmd.action == TUNE || cmd.action == FFCAL ||
+       (cmd.action == GOTO && mFunc == GOTO) ||
+       (cmd.action == TURN && (mFunc == LEFT || mFunc == RIGHT))){
+      runSeq = tail;                                              // Finished by the control loop
+      return(TRUE);
+    }
+    doneSeq = tail;
+    if(cmd.action == MOVE){
+      openSeq = tail;                                             // Runs until more is queued
+      return(TRUE);
+    }
+  }
+  return(FALSE);
+}
+
+/* Drop the commands queued before the last STOP (motor cog only) */
+static void queueFlush(void){
+  unsigned int to;
+  unsigned int running = runSeq ? runSeq : openSeq;
+
+  flushSeen = flushReq;
+  QUEUE_BARRIER();
+  to = flushTo;
+  if((int)(to - qTail) > 0)
+    qTail = to;
+  if((int)(to - running) >= 0){                                   // Not queued after the STOP
+    runSeq = openSeq = 0;
+    if(directSeq == flushDirect)                                  // Unless a command came directly
+      mFunc = STOP;                                               //  after it, stop what ran.
+  }
+  if((int)(to - doneSeq) > 0)
+    doneSeq = to;                                                 // Dropped entries count as done
+}
+
+/* Drop the running and queued commands after a stall (motor cog only) */
+static void queueStall(void){
+  unsigned int head = qHead;
+
+  qTail = head;                                                   // Queued after this waits for
+  runSeq = openSeq = 0;                                           //  the caller to clear STALL.
+  doneSeq = head;
+}
+
+/*
+ *  Queue a command for the motor cog.
+ *  Returns its sequence number, or 0 if MOTOR_QUEUE commands are
+ *  already waiting.
+ */
+unsigned int motorQueue(struct cmd_struct cmd){
+  unsigned int head = qHead;
+
+  if(head - qTail >= MOTOR_QUEUE)
+    return(0);                                                    // Full, caller decides what to do
+  motorQ[head & (MOTOR_QUEUE - 1)] = cmd;
+  QUEUE_BARRIER();                                                // Command is in place before it is
+  qHead = head + 1;                                               //  made visible to the motor cog.
+  return(head + 1);
+}
+
+/* TRUE once queued command seq has finished (or was dropped by STOP or a STALL) */
+int motorDone(unsigned int seq){
+  return((int)(doneSeq - seq) >= 0);
+}
+
+/*
+ *  Wait for queued command seq to finish. A timeout of zero waits
+ *  forever. Seq 0 is a command motorQueue() could not queue, so it
+ *  never finishes: FALSE at once.
+ */
+int motorWait(unsigned int seq, int timeoutMs){
+  unsigned int start = CNT;
+  unsigned int limit = timeoutMs * (CLKFREQ / 1000);
+
+  if(seq == 0)
+    return(FALSE);
+  while(!motorDone(seq)){
+    if(timeoutMs > 0 && CNT - start >= limit)
+      return(FALSE);
+    pause(1);
+  }
+  return(TRUE);
+}
+
+/*
+ *  Queue a route of count waypoints, as inches x ahead of and y to
+ *  the left of the origin heading, to be driven through at vel %.
+ *  Waits for queue space as needed and returns the sequence number
+ *  of the last waypoint.
+ */
+unsigned int motorFollow(const int path[][2], int count, int vel){
+  struct cmd_struct cmd;
+  unsigned int seq = 0;
+  int   i;
+
+  cmd.action = GOTO;
+  cmd.direction = vel;
+  for(i = 0; i < count; i++){
+    cmd.value1 = path[i][0];
+    cmd.value2 = path[i][1];
+    while((seq = motorQueue(cmd)) == 0)
+      pause(1);                                                   // Queue full, wait for the motor cog
+  }
+  return(seq);
+}
+
+/* TRUE if control gains in 1/1000 are in range to run the loop on */
+static int gainsValid(int kPro, int kInt, int kDrv){
+  return(kPro > 0 && kPro <= GAIN_MAX &&
+         kInt >= 0 && kInt <= GAIN_MAX &&
+         kDrv >= 0 && kDrv <= GAIN_MAX);
+}
+
+/* Use new control gains, given in 1/1000 */
+static void setGains(int kPro, int kInt, int kDrv){
+  kpGain = GAIN_OF(KP_STEP(kPro / 1000.0));
+  kiGain = GAIN_OF(KI_STEP(kInt / 1000.0));
+  kdGain = GAIN_OF(KD_STEP(kDrv / 1000.0));
+#ifdef MOTOR_FIXED
+  integralMax = 0x3FFFFFFF / (kiGain > 0 ? kiGain : 1);
+#endif
+  gainSet[0] = kPro;
+  gainSet[1] = kInt;
+  gainSet[2] = kDrv;
+}
+
+/*
+ *  Tune the control gains and wait for the result (about TUNE_MS).
+ *  The robot drives forward about a foot, so give it room. Returns
+ *  TRUE if new gains were found and saved to EEPROM.
+ */
+int motorTune(void){
+  struct cmd_struct cmd;
+
+  cmd.action = TUNE;
+  motorCommand(cmd);
+  while(tuneResult == 0)
+    pause(10);
+  return(tuneResult == PASS);
+}
+
+/*
+ *  Calibrate the feed forward tables and wait for the result (about
+ *  ten seconds). The robot drives forward about two feet and back
+ *  again, so give it room. Returns TRUE if the tables were saved to
+ *  EEPROM.
+ */
+int motorCalibrate(void){
+  struct cmd_struct cmd;
+
+  cmd.action = FFCAL;
+  motorCommand(cmd);
+  while(ffResult == 0)
+    pause(10);
+  return(ffResult == PASS);
+}
+
+/* TRUE if motorTune() gains are saved in EEPROM */
+int motorHasGains(void){
+  return(ee_getByte(_EE_ADDR_START + _EE_MTR_ID) == TUNE_ID);
+}
+
+/* TRUE if motorCalibrate() feed forward tables are saved in EEPROM */
+int motorHasFeed(void){
+  return(ee_getByte(_EE_ADDR_START + _EE_FF_ID) == FF_ID);
+}
+
+/* Current control gains in 1/1000 (K_PRO, K_INT & K_DRV unless tuned) */
+void motorGetGains(int *kPro, int *kInt, int *kDrv){
+  *kPro = gainSet[0];
+  *kInt = gainSet[1];
+  *kDrv = gainSet[2];
+}
 
 /* Start SpeedControl function in separate cog*/
 int initMotorControl(void){
+  int   kPro, kInt, kDrv;
+
+  if(motorHasGains()){                                       // If EEProm holds tuned gains.
+    kPro = ee_getInt(_EE_ADDR_START + _EE_MTR_KPRO);
+    kInt = ee_getInt(_EE_ADDR_START + _EE_MTR_KINT);
+    kDrv = ee_getInt(_EE_ADDR_START + _EE_MTR_KDRV);
+    if(gainsValid(kPro, kInt, kDrv))                         // Otherwise keep K_PRO, K_INT &
+      setGains(kPro, kInt, kDrv);                            //  K_DRV.
+  }
+  if(motorHasFeed()){                                        // If EEProm holds feed forward tables.
+    for(int w = 0; w < 2; w++)
+      for(int d = 0; d < 2; d++)
+        for(int k = 0; k <= FF_HALF; k++)
+          ffVel[w][d][k] = ee_getInt(_EE_ADDR_START + _EE_FF_TABLE + 4 * FF_ENTRY(w, d, k));
+  } else
+    ffLine();
   int mymtr_cogID = cogstart(&motorControl, NULL, mymtr_stack, sizeof(mymtr_stack));
   return(mymtr_cogID);
 }
 
+/*
+ *  Dead reckoning update for one control interval.
+ *  Returns the distance traveled (in inches) since the last update.
+ */
+static mnum updatePose(int left_velClicks, int right_velClicks){
+  int   heading = compass_diff(orgHeading, curHeading);           // Heading from the origin's, + = left
+  mnum  deltaDist;                                                // Distance traveled since last check.
+
+#ifdef MOTOR_FIXED
+  int   clickSum = left_velClicks + right_velClicks;              // Sum of both wheels' clicks
+
+  deltaDist = clickSum * DIST_HALF;                               // Avg click distance of both wheels
+  poseWriteBegin();                                               // Indicate we are updating gps data
+  gpsX += clickSum * ((DIST_HALF * icos(heading)) >> 15);         // Update global x-y position with
+  gpsY += clickSum * ((DIST_HALF * isin(heading)) >> 15);         //  latest incremental changes.
+  gps.xPos = gpsX / (float) FIX_ONE;                              // Publish for motorGetPose()
+  gps.yPos = gpsY / (float) FIX_ONE;
+  gps.gHeading = curHeading;                                      // Record current global heading
+  gps.rHeading = FIX_INT(TO_NUM(gps.rHeading) +                   // Update relative heading with
+                 (right_velClicks - left_velClicks) * DEG_CLICK); //  new delta based on clicks.
+#else
+  float deltaX = 0.0, deltaY = 0.0;                               // Delta X & Y offset from last location
+
+  deltaDist = 0.5 * (float) (left_velClicks + right_velClicks)    // Avg click distance of both wheels
+              * DIST_PER_CLICK;                                   // times distance per click
+  deltaX = deltaDist * icos(heading) / TRIG_ONE;                  // Calculate Delta in X position
+  deltaY = deltaDist * isin(heading) / TRIG_ONE;                  // Calculate Delta in Y position
+  
+  poseWriteBegin();                                               // Indicate we are updating gps data
+  gps.xPos += deltaX;                                             // Update global x-y position with
+  gps.yPos += deltaY;                                             //  latest incremenetal changes.
+  gps.gHeading = curHeading;                                      // Record current global heading
+  gps.rHeading += (float)(right_velClicks - left_velClicks)       // Update relative heading with
+                  * DEG_PER_CLICK;                                //  new delta based on clicks.
+#endif
+  if(setPosReq){                                                  // Position set by motorCommand()
+    gps.xPos = setPosX;                                           // Set/Reset global x position coordinate.
+    gps.yPos = setPosY;                                           // Set/Reset global y position coordinate.
+#ifdef MOTOR_FIXED
+    gpsX = TO_NUM(setPosX);                                       // Keep fixed point copies in step.
+    gpsY = TO_NUM(setPosY);
+#endif
+    if(setPosX == 0 && setPosY == 0){                             // If setting the origin location...
+      gps.rHeading = 0;                                           //  Set relative heading to zero.
+      orgHeading = curHeading;                                    //  Remember origin compass heading.
+    }
+    setPosReq = 0;
+  }
+  poseWriteEnd();                                                 // Indicate gps update is complete.
+  return(deltaDist);
+}
+
+/* Integer square root */
+static int isqrt(unsigned int n){
+  unsigned int root = 0, bit = 1u << 30;
+
+  while(bit > n) bit >>= 2;
+  while(bit){
+    if(n >= root + bit){
+      n -= root + bit;
+      root = (root >> 1) + bit;
+    } else
+      root >>= 1;
+    bit >>= 2;
+  }
+  return(root);
+}
+
+/*
+ *  Motion profile update for an interval of tickMs.
+ *  The acceleration toward the target velocity is no more than can
+ *  be wound back to zero within the jerk limit, so the profile
+ *  eases onto its target without overshoot.
+ *  Returns the velocity setpoint in 1/PROF_SCALE clicks per interval.
+ */
+static int profileStep(int tickMs){
+  int   target = des_vel_clicks * PROF_SCALE;                     // Cruise velocity
+  int   want, step, left, dv, delay;
+  mnum  rem = pathLeft;                                           // Distance left on the route
+
+  if(mFunc == GOTO && target > pathCap)
+    target = pathCap;                                             // Slow down for the curve
+  if(mFunc != GOTO)
+    rem = desInchDist - curInchDist + queuedDist();               //  or move, queued moves included.
+  if((desInchDist > 0 || mFunc == GOTO) && rem < TO_NUM(PROF_NEAR)){
+    left = PROF_DIST(rem);
+    delay = PROF_BRAKE * (tickMs + PROF_RAMP) / CTRL_REF;         // Braking starts up to a tick late
+    want = (isqrt(delay * delay + 4 * PROF_BRAKE * left) - delay) / 2; //  and then ramps in.
+    if(want < PROF_CREEP) want = PROF_CREEP;                      // Creep the last part
+    if(want < target) target = want;                              // On the braking curve
+  }
+  dv = target - profVel;
+  want = isqrt(2 * PROF_JERK * abs(dv));                          // Most acceleration that can
+  if(want > PROF_ACCEL) want = PROF_ACCEL;                        //  still ease in to the target.
+  if(dv < 0) want = -want;
+  step = PROF_JERK * tickMs / 1000;                               // Jerk limit
+  if(want > profAcc + step) want = profAcc + step;
+    else if(want < profAcc - step) want = profAcc - step;
+  profAcc = want;
+  profVel += profAcc * tickMs / 1000;
+  if((dv > 0 && profVel > target) || (dv < 0 && profVel < target)){
+    profVel = target;                                             // Arrived
+    profAcc = 0;
+  }
+  return(profVel);
+}
+
+/*
+ *  Pure pursuit update for one control interval.
+ *  Sets setSteer so the wheels follow the arc through the look ahead
+ *  point, moves on to the next queued waypoint near the current one
+ *  and stops (or starts the next command) at the last.
+ */
+static void pathStep(void){
+  int   px, py, dx, dy, sx, sy, seg, along, dist, look, alpha, arc;
+  mnum  more;
+
+#ifdef MOTOR_FIXED
+  px = gpsX / (FIX_ONE / PATH_SCALE);                             // Robot position in route units
+  py = gpsY / (FIX_ONE / PATH_SCALE);
+#else
+  px = gps.xPos * PATH_SCALE;
+  py = gps.yPos * PATH_SCALE;
+#endif
+  dx = pathToX - px;                                              // Way to the waypoint
+  dy = pathToY - py;
+  dist = isqrt(dx * dx + dy * dy);
+  more = queuedDist();                                            // Route queued after this waypoint
+  if(dist < PATH_LOOK * PATH_SCALE && more > 0){
+    queueNext();                                                  // Close enough, on to the next one
+    dx = pathToX - px;
+    dy = pathToY - py;
+    dist = isqrt(dx * dx + dy * dy);
+    more = queuedDist();
+  }
+  sx = pathToX - pathFromX;                                       // This leg of the route
+  sy = pathToY - pathFromY;
+  seg = isqrt(sx * sx + sy * sy);
+  along = seg ? ((px - pathFromX) * sx + (py - pathFromY) * sy) / seg : 0;
+  if(more == 0 && (dist < PATH_ARRIVE * PATH_SCALE || along >= seg)){
+    setSteer = 0;                                                 // At (or past) the last waypoint
+    if(!queueNext())
+      mFunc = STOP;
+    return;
+  }
+  pathLeft = PATH_NUM(dist) + more;
+
+  look = along + PATH_LOOK * PATH_SCALE;                          // Look ahead point on the leg,
+  if(look < seg){                                                 //  or the waypoint itself.
+    dx = pathFromX + sx * look / seg - px;
+    dy = pathFromY + sy * look / seg - py;
+  }
+  alpha = iatan2(dy, dx) - compass_diff(orgHeading, curHeading);  // Bearing from our heading
+  if(alpha > 180) alpha -= 360;
+    else if(alpha < -180) alpha += 360;
+  look = isqrt(dx * dx + dy * dy);
+  if(look < PATH_LOOK * PATH_SCALE)
+    look = PATH_LOOK * PATH_SCALE;                                // Don't circle the last waypoint
+  if(alpha >= 90 || alpha <= -90)
+    arc = alpha > 0 ? TRIG_ONE : -TRIG_ONE;                       // Behind us, pivot on one wheel
+  else
+    arc = PATH_TRACK * isin(alpha) / look;                        // Arc: v * track * sin(a) / L
+  setSteer = setVel * arc / TRIG_ONE;
+  pathCap = CLICKS_OF(V_MAX) * PROF_SCALE * TRIG_ONE / (TRIG_ONE + abs(arc));
+  if(setSteer > setVel) setSteer = setVel;                        // Inner wheel no slower than stopped
+    else if(setSteer < -setVel) setSteer = -setVel;
+}
+
+/*
+ *  Feed forward servo power for a wheel velocity in profile units,
+ *  in 1/VEL_SCALE percent, from the wheel's table for the direction
+ *  of travel. Between steps the power is interpolated, so a velocity
+ *  just above a deadband starts at the power where the wheel began
+ *  to turn.
+ */
+static int ffPower(int w, int vel){
+  int   *v = ffVel[w][mFunc == BACKWARD];
+  int   k;
+
+  if(vel <= 0)
+    return(0);
+  for(k = 1; k <= FF_HALF; k++)
+    if(v[k] >= vel)                                               // v[k - 1] < vel, so v[k] > v[k - 1]
+      return((k - 1) * FF_STEP * VEL_SCALE + FF_STEP * VEL_SCALE * (vel - v[k - 1]) / (v[k] - v[k - 1]));
+  return(POWER_MAX);                                              // Faster than the wheel will go
+}
+
+/* Straight CLICKS line in the feed forward tables (no FFCAL saved) */
+static void ffLine(void){
+  int   w, d, k;
+
+  for(w = 0; w < 2; w++)
+    for(d = 0; d < 2; d++)
+      for(k = 0; k <= FF_HALF; k++)
+        ffVel[w][d][k] = (int)(CLICKS * k * FF_STEP * PROF_SCALE);
+}
+
+/* Wheel velocity the feed forward table gives for a servo power (%), in profile units */
+static int ffVelocity(int w, int power){
+  int   *v = ffVel[w][(mFunc == BACKWARD) != (power < 0)];        // Negative power turns it back
+  int   k;
+
+  power = abs(power);
+  if(power >= V_MAX)
+    return(v[FF_HALF]);
+  k = power / FF_STEP;
+  return(v[k] + (v[k + 1] - v[k]) * (power - k * FF_STEP) / FF_STEP);
+}
+
+/*
+ *  Stall and slip check for one control interval (motor cog only).
+ *  Velocities are in 1/VEL_SCALE clicks per CTRL_REF interval, clicks
+ *  are those counted this interval. Returns TRUE once a wheel has
+ *  stalled or slipped for STALL_COUNT intervals, or has jammed.
+ */
+static int stallStep(int left_vel, int right_vel, int left_clicks, int right_clicks){
+  int   vel[2] = {left_vel, right_vel};
+  int   clicks[2] = {left_clicks, right_clicks};
+  int   w, expect, turn, stalled = FALSE, jammed = FALSE, slow = FALSE;
+
+  if(mFunc != FORWARD && mFunc != BACKWARD && mFunc != GOTO){
+    stallCount = slipSum = 0;                                     // Only checked while driving
+    stallVel[0] = stallVel[1] = 0;
+    stallHeading = curHeading;
+    return(FALSE);
+  }
+  for(w = 0; w < 2; w++){
+    expect = ffVelocity(w, mPower[w]);                            // Power set for this interval
+    if(clicks[w] != 0)
+      stallVel[w] = vel[w];
+    if(expect < STALL_MIN * PROF_SCALE){
+      slow = TRUE;                                                // Too slow to check
+      continue;
+    }
+    if(vel[w] * (PROF_SCALE / VEL_SCALE) * STALL_RATIO < expect)
+      stalled = TRUE;                                             // Power, but hardly any clicks
+#ifdef CTRL_FAST
+    if(clicks[w] == 0 && stallVel[w] * (PROF_SCALE / VEL_SCALE) * STALL_RATIO >= expect &&
+       vel[w] * (PROF_SCALE / VEL_SCALE) * STALL_GAP < expect &&
+       vel[w] * STALL_GAP_MS < VEL_SCALE * CTRL_REF)
+      jammed = TRUE;                                              // Was running, no edge since
+#endif
+  }
+  stallCount = jammed ? STALL_COUNT : stalled ? stallCount + 1 : 0;
+
+  turn = (right_clicks - left_clicks) * SLIP_CLICK;               // Left turn by the wheels
+  if(mFunc == BACKWARD)
+    turn = -turn;
+  turn -= compass_diff(stallHeading, curHeading) * 16;            //  less the compass's.
+  stallHeading = curHeading;
+  if(slow)
+    slipSum = 0;                                                  // Steering hard, clicks too coarse
+  else
+    slipSum += turn - slipSum / STALL_COUNT;                      // About STALL_COUNT intervals' worth
+
+  return(stallCount >= STALL_COUNT || abs(slipSum) > SLIP_DEG * 16);
+}
+
+/*
+ *  PID update of the servo power for one control interval.
+ *  Velocities are in 1/VEL_SCALE clicks per CTRL_REF interval and
+ *  the power is adjusted in 1/VEL_SCALE percent. The power is a
+ *  running sum, so each wheel's speed error (K_PRO) integrates to
+ *  zero, K_DRV takes off the change in speed to damp it, and the
+ *  integral of left less right (K_INT) is added to one wheel and
+ *  taken from the other so the two wheels come out even.
+ *  Returns FALSE in straight motor mode, where mPower is not used.
+ */
+static int updatePower(int left_velClicks, int right_velClicks){
+  int   leftDelta = setVel - setSteer - left_velClicks;           // Left Delta between Actual vs Desired speed
+  int   rightDelta = setVel + setSteer - right_velClicks;         // Right Delta between Actual vs Desired speed
+  int   leftStep = ffPower(0, (setVel - setSteer) * (PROF_SCALE / VEL_SCALE)) - // Feed forward power
+                   ffPower(0, (setLast - steerLast) * (PROF_SCALE / VEL_SCALE));   //  for setpoint changes
+  int   rightStep = ffPower(1, (setVel + setSteer) * (PROF_SCALE / VEL_SCALE)) -  //  since last interval.
+                    ffPower(1, (setLast + steerLast) * (PROF_SCALE / VEL_SCALE));
+  mnum  leftError = 0, rightError = 0;                            // Velocity error values
+
+  integral   += left_velClicks - right_velClicks +                // Integrate Left & Right velocity
+                des_bias_clicks * VEL_SCALE;                      //  with desired bias.
+  if(setSteer != 0)                                               // It steers for a straight line,
+    integral = 0;                                                 //  so it would fight a GOTO arc.
+#ifdef MOTOR_FIXED
+  if(integral > integralMax) integral = integralMax;              // Keep fixed point math in range
+    else if(integral < -integralMax) integral = -integralMax;
+#endif
+  if(mMode == 0x00)                                               // Straight motor mode
+    return(FALSE);
+#ifdef CTRL_FAST
+  if(powerFine[0] / VEL_SCALE != mPower[0]){                      // mPower was reset or set elsewhere
+    powerFine[0] = mPower[0] * VEL_SCALE;
+    powerRest[0] = 0;
+  }
+  if(powerFine[1] / VEL_SCALE != mPower[1]){
+    powerFine[1] = mPower[1] * VEL_SCALE;
+    powerRest[1] = 0;
+  }
+#endif
+
+#ifdef MOTOR_FIXED
+  if((mMode & 0x01) == 0x01){                                     // Errors here are already scaled
+    leftError  = kpGain * leftDelta;                              //  to servo percent (1/CLICKS).
+    rightError = kpGain * rightDelta;                             // Proportional speed adjustments 
+  }
+  if((mMode & 0x02) == 0x02){
+    leftError  -= kiGain * integral;                              // Plus Integral error, which
+    rightError += kiGain * integral;                              //  slows the wheel that is ahead
+  }
+  if((mMode & 0x04) == 0x04){
+    leftError  -= kdGain * (left_velClicks - leftLast);           // Less Derivative (damping)
+    rightError -= kdGain * (right_velClicks - rightLast);
+  }
+  leftError  += powerRest[0];                                     // Steps under a whole unit of
+  rightError += powerRest[1];                                     //  power add up until they are one
+  POWER[0] += FIX_INT(leftError) + leftStep;                      // Adjust left servo %vel if necessary
+  POWER[1] += FIX_INT(rightError) + rightStep;                    // Adjust right servo %vel if necessary
+  powerRest[0] = leftError - TO_NUM(FIX_INT(leftError));
+  powerRest[1] = rightError - TO_NUM(FIX_INT(rightError));
+#else
+  float integralError = kiGain * integral;                        // Integral error between servos
+
+  if((mMode & 0x01) == 0x01){
+    leftError  = kpGain * leftDelta;                              // Proportional speed adjustments 
+    rightError = kpGain * rightDelta;                             //  of left & right servos.
+  }
+  if((mMode & 0x02) == 0x02){
+    leftError  -= integralError;                                  // Plus Integral error, which
+    rightError += integralError;                                  //  slows the wheel that is ahead
+  }
+  if((mMode & 0x04) == 0x04){
+    leftError  -= kdGain * (left_velClicks - leftLast);           // Less Derivative (damping)
+    rightError -= kdGain * (right_velClicks - rightLast);
+  }
+  leftError  = leftError / CLICKS + powerRest[0];                 // Steps under a whole unit of
+  rightError = rightError / CLICKS + powerRest[1];                //  power add up until they are one
+  POWER[0] += (int) leftError + leftStep;                         // Adjust left servo %vel if necessary
+  POWER[1] += (int) rightError + rightStep;                       // Adjust right servo %vel if necessary
+  powerRest[0] = leftError - (int) leftError;
+  powerRest[1] = rightError - (int) rightError;
+#endif
+  setLast = setVel;
+  steerLast = setSteer;
+  leftLast = left_velClicks;                                      // Remember current left velocity
+  rightLast = right_velClicks;                                    // Remember current right velocity
+
+  if (POWER[0] > POWER_MAX) POWER[0] = POWER_MAX;                 // Limit max left servo velocity
+    else if (POWER[0] < -POWER_MAX) POWER[0] = -POWER_MAX;
+  if (POWER[1] > POWER_MAX) POWER[1] = POWER_MAX;                 // Limit max right servo velocity
+    else if (POWER[1] < -POWER_MAX) POWER[1] = -POWER_MAX;
+#ifdef CTRL_FAST
+  mPower[0] = powerFine[0] / VEL_SCALE;
+  mPower[1] = powerFine[1] / VEL_SCALE;
+#endif
+  return(TRUE);
+}
+
+/*
+ *  Run the wheels at their set power for ms and time the encoder
+ *  edges (motor cog only). Edges after the first skip ms (above 0)
+ *  are timed: n1 & t1 are the count and CNT from the start at the
+ *  first of them, n2 & t2 at the last.
+ */
+static void timeEdges(int ms, int skip, struct edgeSpan *span){
+  unsigned int  poll = ENC_POLL_US * (CLKFREQ / 1000000);
+  unsigned int  start, now, next, base[2], count[2];
+  int   w, sending = FALSE;
+
+  for(w = 0; w < 2; w++)
+    span[w].count = span[w].n1 = span[w].n2 = span[w].t1 = span[w].t2 = 0;
+  base[0] = ENC_COUNT(0);                                         // Counters run on from here
+  base[1] = ENC_COUNT(1);
+  start = CNT;
+  while((now = CNT) - start < ms * (CLKFREQ / 1000) || sending){
+    count[0] = ENC_COUNT(0) - base[0];
+    count[1] = ENC_COUNT(1) - base[1];
+    for(w = 0; w < 2; w++){
+      if(count[w] != span[w].count){                              // Time each new edge
+        span[w].count = count[w];
+        if(now - start >= skip * (CLKFREQ / 1000)){
+          if(span[w].t1 == 0){
+            span[w].n1 = count[w];
+            span[w].t1 = now - start;
+          }
+          span[w].n2 = count[w];
+          span[w].t2 = now - start;
+        }
+      }
+    }
+    next = DRIVE_DUE(now + poll);
+    if((int)(next - CNT) > 400)                                   // A servo pulse change may be due
+      waitcnt(next);
+    sending = DRIVE_STEP();                                       // Finish a frame past ms
+  }
+}
+
+/* Hand clicks counted outside the control loop to the encoders & pose */
+static void edgesDone(int left, int right){
+  encSync();                                                      // Clicks were counted here
+  updatePose(left, right);
+}
+
+/*
+ *  Tune the control gains from a step response (motor cog only).
+ *  Drives forward for TUNE_MS. Returns TRUE and saves the new gains
+ *  to EEPROM, or FALSE with the gains unchanged if a wheel hardly
+ *  turned or the gains came out of range.
+ */
+static int tuneGains(void){
+  struct edgeSpan span[2], coast[2];
+  float gain = 0, tau = 0, vel, lag, wn, pro, drv;
+  int   w, ok = TRUE, kPro, kInt, kDrv;
+
+  set_servo(TUNE_POWER, 0);                                       // Step both wheels forward
+  set_servo(TUNE_POWER, 1);
+  timeEdges(TUNE_MS, TUNE_MS / 3, span);                          // Up to speed after a third
+  set_servo(0, 0);
+  set_servo(0, 1);
+  timeEdges(FF_SETTLE, FF_SETTLE, coast);                         // Coast to a stop
+
+  for(w = 0; w < 2; w++){
+    if(span[w].n2 - span[w].n1 < TUNE_EDGES){
+      ok = FALSE;                                                 // Wheel off the ground or stalled
+      break;
+    }
+    vel = (span[w].n2 - span[w].n1) * (float) CLKFREQ / (span[w].t2 - span[w].t1); // Clicks per second
+    gain += vel * CTRL_REF / 1000 / (CLICKS * TUNE_POWER) / 2;    // Against CLICKS, both wheels
+    tau += ((float) span[w].t2 / CLKFREQ - span[w].n2 / vel) / 2; // Where the line crosses zero
+  }
+  edgesDone(span[0].count + coast[0].count,                       // Straight ahead, about a foot
+            span[1].count + coast[1].count);
+  if(!ok)
+    return(FALSE);
+
+  if(tau < 0.02) tau = 0.02;                                      // Keep the model sensible
+    else if(tau > 1.0) tau = 1.0;
+  lag = tau + CTRL_INT / 1000.0;                                  // Wheel lag and loop delay
+  wn = TUNE_SPEED / lag;
+  pro = lag * wn * wn * CTRL_REF / 1000;                          // Integral of velocity error
+  drv = 2 * TUNE_ZETA * wn * lag - 1;                             // Velocity feedback, which
+  if(drv < 0) drv = 0;                                            //  damps, so never below none
+  kPro = (int)(1000 * pro / gain);
+  kInt = (int)(1000 * K_INT * pro / K_PRO / gain);                // Left/right match keeps its
+  kDrv = (int)(1000 * drv / gain);                                //  ratio to K_PRO
+  if(!gainsValid(kPro, kInt, kDrv))
+    return(FALSE);
+  setGains(kPro, kInt, kDrv);
+  ee_putByte(TUNE_ID, _EE_ADDR_START + _EE_MTR_ID);               // Mark valid gains
+  ee_putInt(gainSet[0], _EE_ADDR_START + _EE_MTR_KPRO);
+  ee_putInt(gainSet[1], _EE_ADDR_START + _EE_MTR_KINT);
+  ee_putInt(gainSet[2], _EE_ADDR_START + _EE_MTR_KDRV);
+  return(TRUE);
+}
+
+/*
+ *  Calibrate the feed forward tables (motor cog only). Steps both
+ *  wheels forward through each FF_STEP of power, then back the same
+ *  way, timing the edges at each step once the wheel has settled.
+ *  Returns TRUE and saves the tables to EEPROM, or FALSE with the
+ *  tables unchanged if a wheel hardly turned at full power.
+ */
+static int calibrateFeed(void){
+  struct edgeSpan span[2];
+  int   table[2][2][FF_HALF + 1];
+  int   moved[2];
+  int   w, d, k, vel;
+
+  for(d = 0; d < 2; d++){                                         // Forward, then backward
+    moved[0] = moved[1] = 0;
+    table[0][d][0] = table[1][d][0] = 0;
+    for(k = 1; k <= FF_HALF; k++){
+      set_servo(d ? -k * FF_STEP : k * FF_STEP, 0);
+      set_servo(d ? -k * FF_STEP : k * FF_STEP, 1);
+      timeEdges(FF_SETTLE + FF_MS, FF_SETTLE, span);
+      for(w = 0; w < 2; w++){
+        moved[w] += span[w].count;
+        vel = 0;                                                  // No edge, deadband
+        if(span[w].n2 > span[w].n1)
+          vel = (int)((span[w].n2 - span[w].n1) * (float) CLKFREQ * CTRL_REF / 1000 * PROF_SCALE
+                / (span[w].t2 - span[w].t1));
+        else if(span[w].t1)
+          vel = PROF_SCALE * CTRL_REF / FF_MS;                    // One edge, about a click per FF_MS
+        if(vel < table[w][d][k - 1])
+          vel = table[w][d][k - 1];                               // Keep the table rising
+        table[w][d][k] = vel;
+      }
+    }
+    set_servo(0, 0);
+    set_servo(0, 1);
+    timeEdges(FF_SETTLE, FF_SETTLE, span);                        // Coast to a stop
+    moved[0] += span[0].count;
+    moved[1] += span[1].count;
+    if(d)
+      edgesDone(-moved[0], -moved[1]);                            // Back about where it started
+    else
+      edgesDone(moved[0], moved[1]);
+  }
+  for(w = 0; w < 2; w++)
+    for(d = 0; d < 2; d++)
+      if(table[w][d][FF_HALF] < FF_MIN)
+        return(FALSE);                                            // Wheel off the ground or stalled
+
+  ee_putByte(FF_ID, _EE_ADDR_START + _EE_FF_ID);                  // Mark a valid table
+  for(w = 0; w < 2; w++)
+    for(d = 0; d < 2; d++)
+      for(k = 0; k <= FF_HALF; k++){
+        ffVel[w][d][k] = table[w][d][k];
+        ee_putInt(table[w][d][k], _EE_ADDR_START + _EE_FF_TABLE + 4 * FF_ENTRY(w, d, k));
+      }
+  return(TRUE);
+}
+
+#ifdef MOTOR_LOG
+/*
+ *  Telemetry log (build with -DMOTOR_LOG). At the end of each control
+ *  interval that is not idle the motor cog copies its state into a
+ *  ring of MOTOR_LOG_SIZE frames, a few dozen instructions with no
+ *  conversions: velocities only shift to 1/16 clicks and the pose is
+ *  copied as it is kept. Like the command queue, only the motor cog
+ *  moves logHead and only the reader moves logTail, so the log can
+ *  be drained from any cog. A full ring drops the new frame.
+ */
+static struct motorLog  logRing[MOTOR_LOG_SIZE];
+static volatile unsigned int logHead      = 0;        // Frames written (motor cog only)
+static volatile unsigned int logTail      = 0;        // Frames read (reader only)
+static volatile unsigned int logLost      = 0;        // Frames dropped while the ring was full
+static unsigned short   logSeq            = 0;        // Frames logged or dropped
+static int              logFunc           = STOP;     // Function at the last interval
+
+static void logInterval(int left_vel, int right_vel){
+  struct motorLog *f;
+  unsigned int head = logHead;
+#ifndef MOTOR_FIXED
+  union { float f; int i; } x, y;                       // Float pose is sent as its bits
+#endif
+
+  if(mFunc == logFunc && (mFunc == STOP || mFunc == STALL))
+    return;                                             // Idle, log only the interval that stopped
+  logFunc = mFunc;
+  logSeq++;
+  if(head - logTail >= MOTOR_LOG_SIZE){
+    logLost++;
+    return;
+  }
+  f = &logRing[head & (MOTOR_LOG_SIZE - 1)];
+  f->time = CNT;
+  f->vel[0] = left_vel * (16 / VEL_SCALE);
+  f->vel[1] = right_vel * (16 / VEL_SCALE);
+  f->err[0] = (setVel - setSteer - left_vel) * (16 / VEL_SCALE);
+  f->err[1] = (setVel + setSteer - right_vel) * (16 / VEL_SCALE);
+  f->power[0] = mPower[0];
+  f->power[1] = mPower[1];
+  f->heading = gps.rHeading;                            // Only this cog writes gps
+  f->func = mFunc;
+  f->seq = logSeq;
+#ifdef MOTOR_FIXED
+  f->xPos = gpsX;
+  f->yPos = gpsY;
+  f->flags = LOG_FIXED;
+#else
+  x.f = gps.xPos;
+  y.f = gps.yPos;
+  f->xPos = x.i;
+  f->yPos = y.i;
+  f->flags = 0;
+#endif
+  QUEUE_BARRIER();                                      // Frame is in place before it is
+  logHead = head + 1;                                   //  made visible to the reader.
+}
+
+/* Oldest logged control interval. Returns TRUE, or FALSE if there is none */
+int motorLogRead(struct motorLog *frame){
+  unsigned int tail = logTail;
+
+  if(logHead == tail)
+    return(FALSE);
+  QUEUE_BARRIER();
+  *frame = logRing[tail & (MOTOR_LOG_SIZE - 1)];
+  QUEUE_BARRIER();                                      // Frame is copied out before the
+  logTail = tail + 1;                                   //  motor cog may reuse it.
+  return(TRUE);
+}
+
+/*
+ *  Send up to max logged intervals out a serial port, each as
+ *  LOG_SYNC, the frame and the 8 bit sum of the frame's bytes.
+ *  Call it from a low priority task or loop; at 115200 baud a frame
+ *  takes about 2.5ms. Returns the number of frames sent.
+ */
+int motorLogSend(serial *port, int max){
+  struct motorLog frame;
+  unsigned char *b = (unsigned char *) &frame;
+  unsigned char sum;
+  int   n;
+  unsigned int i;
+
+  for(n = 0; n < max && motorLogRead(&frame); n++){
+    serial_txChar(port, LOG_SYNC);
+    for(sum = 0, i = 0; i < sizeof(frame); i++){
+      sum += b[i];
+      serial_txChar(port, b[i]);
+    }
+    serial_txChar(port, sum);
+  }
+  return(n);
+}
+
+/* Control intervals dropped because the log was full */
+unsigned int motorLogLost(void){
+  return(logLost);
+}
+#endif
+
 /* MotorControl running in independent cog */
 void motorControl(void *par){
-  float integralError = 0.0;                                      // Integral error between servos
-  float leftError = 0.0, rightError = 0.0;                        // Proportional velocity error values
-  float deltaDist = 0.0;                                          // Distance traveled since last check.
-  float deltaX = 0.0, deltaY = 0.0;                               // Delta X & Y offset from last location
-  int   deltaHeading = 0;                                         // Difference in Heading from last reading
+  mnum  deltaDist = 0.0;                                          // Distance traveled since last check.
   int   left_velClicks = 0, right_velClicks = 0;                  // Current Left & Right velocity (in clicks)
-  int   leftDelta = 0.0, rightDelta = 0.0;                        // Delta between desired and measured velocity
-  int   leftLast = 0, rightLast = 0;                              // Previous Left & Right velocity (in clicks)
+  int   left_vel = 0, right_vel = 0;                              // Velocity estimates (VEL_SCALE clicks)
   int   angleDiff = 0;                                            // Diff between current & desired heading
   int   turnSpeed = 0;                                            // Speed robot should be turning at
+  int   turnDir = 0;                                              // Turn under way (LEFT/RIGHT), else 0
+  int   turnErr = 0;                                              // Heading error at the last tick
+  int   turnRate = 0;                                             // Smoothed heading error rate (deg/s)
+  int   tick = CTRL_INT;                                          // Length of this interval in ms
+  int   lastFunc = STOP;                                          // Move that reached its distance
+  int   steer = 0;                                                // Steering in profile units
 
   init_encoders();                                                // Set up wheel encoders.
   compass_init(MODE_CONT);                                        // Initialize compass.
-  serial *term = serial_open(USB_RX_PIN,USB_TX_PIN,0,115200);     // Debug terminal serial port.
+#ifdef CTRL_FAST
+  unsigned int nextTick = CNT;                                    // Start of the next control interval
+#endif
 
   while(1){
-    left_velClicks = get_velClicks(0);                            // Obtain left velocity (in clicks)
-    right_velClicks = get_velClicks(1);                           // Obtain right velocity (in clicks)
+#ifdef CTRL_FAST
+    left_velClicks = tickEncoder(0, &left_vel);                   // Clicks this interval & timed velocity
+    right_velClicks = tickEncoder(1, &right_vel);
+#else
+    left_velClicks = left_vel = get_velClicks(0);                 // Obtain left velocity (in clicks)
+    right_velClicks = right_vel = get_velClicks(1);               // Obtain right velocity (in clicks)
+#endif
+    if(turnDir == LEFT)                                           // Wheels counter-rotate in a turn,
+      left_velClicks = -left_velClicks;                           //  so pose sees the spin and not
+    else if(turnDir == RIGHT)                                     //  forward travel.
+      right_velClicks = -right_velClicks;
     curHeading = compass_smplHeading();                           // Obtain current global heading
 
-    deltaHeading = compass_diff(curHeading, gps.gHeading);        // Diff between new & prev heading
-    deltaDist = 0.5 * (float) (left_velClicks + right_velClicks)  // Avg click distance of both wheels
-                * DIST_PER_CLICK;                                 // times distance per click
-    deltaX = deltaDist * cos(deltaHeading * PI/180);              // Calculate Delta in X position
-    deltaY = deltaDist * sin(deltaHeading * PI/180);              // Calculate Delta in Y position
-    
-    gps.validPos = 0;                                             // Indicate we are updating gps data
-    gps.xPos += deltaX;                                           // Update global x-y position with
-    gps.yPos += deltaY;                                           //  latest incremenetal changes.
-    gps.gHeading = curHeading;                                    // Record current global heading
-    gps.rHeading += (float)(right_velClicks - left_velClicks)     // Update relative heading with
-                    * DEG_PER_CLICK;                              //  new delta based on clicks.
-    gps.validPos = 1;                                             // Indicate gps update is complete.
-    
+    deltaDist = updatePose(left_velClicks, right_velClicks);      // Dead reckoning position update
+    if(stallStep(left_vel, right_vel, left_velClicks, right_velClicks)){
+      mFunc = STALL;                                              // Wheel stalled or slipping, stop
+      queueStall();                                               //  and drop the rest of the plan.
+    }
+
     if(desInchDist > 0){                                          // If traversing a desired distance
       curInchDist += deltaDist;                                   // Accumulate the overall dist traveled.
       if(curInchDist >= desInchDist){                             // If we've reached our desired dist.
         if(mFunc == FORWARD || mFunc == BACKWARD){                //  and we were going fwd/bkwd
-          mFunc = STOP;                                           //  then stop.
+          deltaDist = curInchDist - desInchDist;                  //  then carry on with the next
+          lastFunc = mFunc;                                       //  queued command, else stop.
+          if(!queueNext())
+            mFunc = STOP;
+          else if(mFunc == lastFunc && desInchDist > 0)
+            curInchDist = deltaDist;                              // Count the overshoot in the next move
         } else{                                                   // Otherwise...
           curInchDist = desInchDist = 0.0;                        //  clear variables and perform new func.
         }
       }
     }                                  
+    if(flushReq != flushSeen)                                     // STOP drops queued commands
+      queueFlush();
+    if(mFunc == STOP || (openSeq && qHead != qTail))              // Idle, or an open move may go on
+      queueNext();
+    if(mFunc == GOTO)
+      pathStep();                                                 // Steer for the next waypoint
+    else
+      setSteer = 0;
     
     switch (mFunc){                                               // Based on desired motor function
       case FORWARD:                                               // Move robot Forward
-      case BACKWARD:                                              //  or Backward.
+      case BACKWARD:                                              //  or Backward,
+      case GOTO:                                                  //  or along a route.
         
-        leftDelta = des_vel_clicks - left_velClicks;              // Left Delta between Actual vs Desired speed
-        rightDelta = des_vel_clicks - right_velClicks;            // Right Delta between Actual vs Desired speed
-
-        integral   += left_velClicks - right_velClicks +          // Integrate Left & Right velocity
-                      des_bias_clicks;                            //  with desired bias.
-        integralError = K_INT * integral;                         // also introduce possible bias.
-        
-        leftError = rightError = 0;                               // Start with error values at zero.
-        if((mMode & 0x01) == 0x01){
-          leftError  = K_PRO * leftDelta;                         // Proportional speed adjustments 
-          rightError = K_PRO * rightDelta;                        //  of left & right servos.
-        }
-        if((mMode & 0x02) == 0x02){
-          leftError  += integralError;                            // Plus Integral error
-          rightError += integralError;
-        }
-        if((mMode & 0x04) == 0x04){
-          leftError  += K_DRV * (left_velClicks - leftLast);      // Add in Derivative error
-          rightError += K_DRV * (right_velClicks - rightLast);
-        }          
-        if(mMode == 0x00){                                        // Straight motor mode,
-          set_servo((des_vel_clicks / CLICKS), 0);                //  so just set servos to
-          set_servo((des_vel_clicks / CLICKS), 1);                //  desired velocity.
-          break;
+        setVel = (profileStep(tick) * VEL_SCALE + PROF_SCALE / 2) / PROF_SCALE;
+        if(updatePower(left_vel, right_vel)){                     // PID adjusted servo power
+          set_servo(mPower[0], 0);                                // Alter left servo speed
+          set_servo(mPower[1], 1);                                // Alter left servo speed
+        } else {                                                  // Straight motor mode,
+          steer = setSteer * (PROF_SCALE / VEL_SCALE);            //  so just set servos to
+          mPower[0] = ffPower(0, profVel - steer) / VEL_SCALE;    //  feed forward power for
+          mPower[1] = ffPower(1, profVel + steer) / VEL_SCALE;    //  the profiled velocity.
+          set_servo(mPower[0], 0);
+          set_servo(mPower[1], 1);
         }
-                  
-        leftLast = left_velClicks;                                // Remember current left velocity
-        rightLast = right_velClicks;                              // Remember current right velocity
-        
-        mPower[0] += leftError / CLICKS;                          // Adjust left servo %vel if necessary
-        mPower[1] += rightError / CLICKS;                         // Adjust right servo %vel if necessary
-
-        if (mPower[0] > V_MAX) mPower[0] = V_MAX;                 // Limit max left servo velocity
-          else if (mPower[0] < -V_MAX) mPower[0] = -V_MAX;
-        if (mPower[1] > V_MAX) mPower[1] = V_MAX;                 // Limit max right servo velocity
-          else if (mPower[1] < -V_MAX) mPower[1] = -V_MAX;
-
-        set_servo(mPower[0], 0);                                  // Alter left servo speed
-        set_servo(mPower[1], 1);                                  // Alter left servo speed
-
         break;
         
       case LEFT:                                                  // Rotate Left or
-      case RIGHT:                                                 //  Right desired number of degrees.
+      case RIGHT:                                                 //  Right to the desired heading.
       
         angleDiff = compass_diff(curHeading, desHeading);         // Diff between cur & Desired heading
-        if (mFunc == LEFT){                                       // Rotate Left desired number of degrees.
-          while(angleDiff > 0){
-            turnSpeed = abs(angleDiff)/2;                         // Use half the turn angle as turn speed.
-            if(turnSpeed < 10) turnSpeed = 10;                    // Unless the turn angle is less than 10.
-            servo_set(WHEEL_L_PIN, 1500-turnSpeed);               // Rotate Left wheel
-            servo_set(WHEEL_R_PIN, 1500-turnSpeed);               // Rotate Right wheel
-            pause(8);                                             // Wait at least 8ms between readings.
-            curHeading = compass_smplHeading();                   // Get current heading from compass
-            angleDiff = compass_diff(curHeading, desHeading);     // Diff between Current & Desired heading
+        if((mFunc == LEFT && angleDiff > 0) || (mFunc == RIGHT && angleDiff < 0)){
+          if(turnDir != mFunc){                                   // First tick of this turn
+            turnErr = abs(angleDiff);
+            turnRate = 0;
           }
+          turnRate = (3 * turnRate +                              // Smooth the rate, the compass updates
+                     (abs(angleDiff) - turnErr) * 1000 / tick) / 4;//  slower than we tick.
+          turnErr = abs(angleDiff);
+          turnSpeed = (TURN_KP * turnErr + TURN_KD * turnRate) / 100; // PD on the heading error
+          if(turnSpeed < TURN_MIN) turnSpeed = TURN_MIN;          // Keep turning until we get there
+          if(turnSpeed > TURN_MAX) turnSpeed = TURN_MAX;
+          if(mFunc == LEFT) turnSpeed = -turnSpeed;
+          servo_set(WHEEL_L_PIN, 1500+turnSpeed);                 // Rotate Left wheel
+          servo_set(WHEEL_R_PIN, 1500+turnSpeed);                 // Rotate Right wheel
+          turnDir = mFunc;
         } else {
-          if ( mFunc == RIGHT){                                   // Rotate Right desired number of degrees.
-            while(angleDiff < 0){
-              turnSpeed = abs(angleDiff)/2;                       // Use half the turn angle as turn speed.
-              if(turnSpeed < 10) turnSpeed = 10;                  // Unless the turn angle is less than 10.
-              servo_set(WHEEL_L_PIN, 1500+turnSpeed);             // Rotate Left wheel
-              servo_set(WHEEL_R_PIN, 1500+turnSpeed);             // Rotate Right wheel
-              pause(8);                                           // Wait at least 8ms between compass readings.
-              curHeading = compass_smplHeading();                 // Get current heading from compass
-              angleDiff = compass_diff(curHeading, desHeading);   // Diff between Current & Desired heading
-            }
-          } else {
-            mFunc = STOP;                                         // Rotation complete or invalid parameters.
-            servo_set(WHEEL_L_PIN, 1500);                         // Force Left servo to stop
-            servo_set(WHEEL_R_PIN, 1500);                         // Force Right servo to stop
-            integral = 0.0;                                       // Reset Integral to zero
-            mPower[0] = mPower[1] = 0;                            // Reset servo velocity to zero
-            desInchDist = curInchDist = 0.0;                      // Reset when you stop.
-          }
-        }          
+          mFunc = STOP;                                           // Rotation complete or invalid parameters.
+          servo_set(WHEEL_L_PIN, 1500);                           // Force Left servo to stop
+          servo_set(WHEEL_R_PIN, 1500);                           // Force Right servo to stop
+          integral = 0.0;                                         // Reset Integral to zero
+          mPower[0] = mPower[1] = 0;                              // Reset servo velocity to zero
+          desInchDist = curInchDist = 0.0;                        // Reset when you stop.
+        }
         break;
         
+      case TUNE:                                                  // Tune the control gains
+        tuneResult = tuneGains() ? PASS : FAIL;
+        mFunc = STOP;                                             // Wheels are stopped, tidy up next
+        break;
+
+      case FFCAL:                                                 // Calibrate the feed forward tables
+        ffResult = calibrateFeed() ? PASS : FAIL;
+        mFunc = STOP;
+        break;
+
+      case STALL:                                                 // Stalled, hold until a new command
       case STOP:                                                  // Stop servo motion immediately
       default:
-        mFunc = STOP;                                             // Set motor function to stop
+        if(mFunc != STALL)
+          mFunc = STOP;                                           // Set motor function to stop
         servo_set(WHEEL_L_PIN, 1500);                             // Force Left servo to stop
         servo_set(WHEEL_R_PIN, 1500);                             // Force Right servo to stop
         integral = 0.0;                                           // Reset Integral to zero
         mPower[0] = mPower[1] = 0;                                // Reset servo velocity to zero
         desInchDist = curInchDist = 0.0;                          // Reset when you stop.
+        setLast = 0;                                              // Next move starts from rest
         break;
     }
-    pause(CTRL_INT);
+#ifdef MOTOR_LOG
+    logInterval(left_vel, right_vel);                             // Record this interval
+#endif
+    if(mFunc == LEFT || mFunc == RIGHT){                          // Turns follow the compass closely,
+      tick = TURN_INT;                                            //  driving follows CTRL_INT.
+    } else {
+      tick = CTRL_INT;
+      if(mFunc == STOP && (runSeq || qHead != qTail))             // Report a finished turn and start
+        tick = TURN_INT;                                          //  queued commands without delay.
+      turnDir = 0;                                                // Turn over or stopped
+    }
+#ifdef CTRL_FAST
+    nextTick += tick * (CLKFREQ / 1000);                          // Fixed rate, not interval + work
+    if((int)(CNT - nextTick) > 0)
+      nextTick = CNT;                                             // Fell behind, restart from now
+    waitEdges(nextTick);                                          // Timestamp edges until then
+#elif defined(DRIVE_COG)
+    drive_wait(CNT + tick * (CLKFREQ / 1000));                    // Servo pulses until then
+#else
+    pause(tick);
+#endif
   }
 }
 
@@ -203,6 +1388,9 @@ void init_encoders(void){
  *  Initialize counters in motor cog to track Left & Right encoders
  *  The rising edge of a pulse indicates a hole in the wheel
  */
+#ifdef DRIVE_COG
+  drive_start();                                        // Servo pulses from this cog too
+#endif
   FRQA = 1;                                             // Add 1 to count at every rising edge.
   PHSA = 0;                                             // Start the edge count at zero.
   FRQB = 1;                                             // Add 1 to count at every rising edge.
@@ -212,31 +1400,123 @@ void init_encoders(void){
   CTRB = 0x28000000 + ENC_R_PIN;                        // Right wheel counter set for positive edges
 }
 
+/* Start counting clicks (and timing edges) from the current counts */
+static void encSync(void){
+  unsigned int count;
+  int   w;
+
+  for(w = 0; w < 2; w++){
+    count = ENC_COUNT(w);
+#ifdef CTRL_FAST
+    addClicks(w, count - enc[w].tickSeen);              // Clicks since the last interval
+    enc[w].seen = enc[w].tickSeen = enc[w].prevSeen = count;
+    enc[w].timed = enc[w].vel = 0;                      // Retime from the next edge
+#else
+    addClicks(w, count - encLast[w]);
+    encLast[w] = count;
+#endif
+  }
+}
+
+#ifdef CTRL_FAST
+/* Note the time of any new encoder edges */
+static void pollEdges(void){
+  unsigned int now = CNT;
+  unsigned int count;
+
+  count = PHSA;                                         // Counters run free, never cleared
+  if(count != enc[0].seen){
+    enc[0].seen = count;
+    enc[0].edgeTime = now;
+  }
+  count = PHSB;
+  if(count != enc[1].seen){
+    enc[1].seen = count;
+    enc[1].edgeTime = now;
+  }
+}
+
+/* Wait until a given CNT value, polling for encoder edges every ENC_POLL_US */
+static void waitEdges(unsigned int until){
+  unsigned int poll = ENC_POLL_US * (CLKFREQ / 1000000);
+  unsigned int next;
+  int   sending = FALSE;
+
+  while((int)(until - CNT) > 0 || sending){             // Finish a servo frame past until
+    next = CNT + poll;
+    if(!sending && (int)(until - next) < 0)
+      next = until;
+    next = DRIVE_DUE(next);
+    if((int)(next - CNT) > 400)                         // A CNT already passed would make waitcnt
+      waitcnt(next);                                    //  wait for a whole roll-over.
+    sending = DRIVE_STEP();
+    pollEdges();
+  }
+}
+
+/*
+ *  Encoder update for one control interval.
+ *  Returns the clicks counted since the last interval and sets *vel
+ *  to the wheel velocity in 1/VEL_SCALE clicks per CTRL_REF interval,
+ *  timed from the edges themselves. With no new edge the velocity
+ *  can be no more than one click in the time since the last edge.
+ */
+static int tickEncoder(int w, int *vel){
+  struct encTrack *e = &enc[w];
+  unsigned int us = CLKFREQ / 1000000;
+  unsigned int edges, span, bound;
+  int   clicks;
+
+  pollEdges();
+  clicks = e->seen - e->tickSeen;                       // Unsigned difference survives wrap
+  e->tickSeen = e->seen;
+  addClicks(w, clicks);
+  edges = e->seen - e->prevSeen;
+
+  if(edges && e->timed){
+    span = (e->edgeTime - e->prevTime) / us;            // Time taken by these edges in us
+    if(span == 0) span = 1;
+    e->vel = edges * VEL_SCALE * CTRL_REF * 1000 / span;
+  } else if(edges){
+    e->vel = clicks * VEL_SCALE * CTRL_REF / CTRL_INT;  // First edges, no start time yet
+  } else if(e->timed){
+    span = (CNT - e->prevTime) / us;                    // Slowing down or stopped
+    bound = span ? VEL_SCALE * CTRL_REF * 1000 / span : e->vel;
+    if(bound < (unsigned int) e->vel)
+      e->vel = bound;
+    if(e->vel == 0)
+      e->timed = 0;                                     // Stopped, retime from the next edge
+  }
+  if(edges){
+    e->prevSeen = e->seen;
+    e->prevTime = e->edgeTime;
+    e->timed = 1;
+  }
+  *vel = e->vel;
+  return(clicks);
+}
+#endif
+
 // Return current velocity of a particular motor in clicks/interval
 float get_velClicks(int motor_index){
-  int count = 0;
+  unsigned int count = ENC_COUNT(motor_index);          // Counters run free, never cleared
+  unsigned int clicks = count - encLast[motor_index];   // Unsigned difference survives wrap
 
-  if (motor_index == 0){
-    count = PHSA;                                       // Retrieve count for left encoder
-    PHSA = 0;                                           // Clear left encoder
-    return count;                                       // Return count for left servo
-  } else {
-    count = PHSB;                                       // Retrieve count for right encoder
-    PHSB = 0;                                           // Clear right encoder
-    return count;                                       // Return count for right servo
-  }
+  encLast[motor_index] = count;
+  addClicks(motor_index, clicks);
+  return clicks;
 }
 
 /* Set the speed of a single servo (0-100%) based on direction and velocity provided */
 void set_servo(int vel, int motor_index){
   if (motor_index == 0){                    // Motor index = 0 (Left servo)
-    if (mFunc == FORWARD){
+    if (mFunc != BACKWARD){
       servo_speed(WHEEL_L_PIN, vel);        // Set left servo speed forward
     } else {
       servo_speed(WHEEL_L_PIN, -vel);       // Set left servo speed reverse
     }
   } else {                                  // Motor index = 1 (Right servo)
-    if (mFunc == FORWARD){
+    if (mFunc != BACKWARD){
       servo_speed(WHEEL_R_PIN, -vel);       // Set right servo speed forward
     } else {
       servo_speed(WHEEL_R_PIN, vel);        // Set right servo speed reverse
@@ -244,25 +1524,28 @@ void set_servo(int vel, int motor_index){
   }
 }
 
-/* Generic robot command structure interface */
-struct cmd_struct motorCommand(struct cmd_struct cmdRequest){
+/* Carry out a command, direct or queued */
+static struct cmd_struct runCommand(struct cmd_struct cmdRequest){
   
   struct cmd_struct cmdResult;
+  struct pose now;
   
   switch(cmdRequest.action){
     case  MOVE:
       if(cmdRequest.direction == FORWARD)
         mSign = 1; else mSign = -1;
-      des_vel_clicks = CLICKS * abs(cmdRequest.value1); // Convert vel to # of Clicks equivalent.
+      des_vel_clicks = CLICKS_OF(abs(cmdRequest.value1)); // Convert vel to # of Clicks equivalent.
       if (cmdRequest.value1 > V_MAX){
-        des_vel_clicks = CLICKS * V_MAX;                // Limit max servo velocity
+        des_vel_clicks = CLICKS_OF(V_MAX);              // Limit max servo velocity
       } else if (cmdRequest.value1 < -V_MAX){
-        des_vel_clicks = CLICKS * V_MAX;                // and convert to # of Clicks equivalent.
+        des_vel_clicks = CLICKS_OF(V_MAX);              // and convert to # of Clicks equivalent.
       }    
-      desInchDist = cmdRequest.value2;                  // Set desired distance if provided.
+      desInchDist = TO_NUM(cmdRequest.value2);          // Set desired distance if provided.
       curInchDist = 0.0;                                // Reset current distance traveled.
       des_bias_clicks = 0;                              // Start bias at zero for a straight line.
       integral = 0.0;                                   // Reset Integral to zero.
+      if(cmdRequest.direction != mFunc)
+        profVel = profAcc = 0;                          // Start from rest, else carry on smoothly.
       mFunc = cmdRequest.direction;                     // Motor function equal to direction of travel.
       break;
     case  TURN:
@@ -271,16 +1554,18 @@ struct cmd_struct motorCommand(struct cmd_struct cmdRequest){
       switch(cmdRequest.direction){
         case RIGHT:
           desHeading = curHeading + cmdRequest.value1;  // Add turn degrees to current heading
-          if (desHeading > 360){
-            desHeading = desHeading - 360;              // Adjust value if result is greater than 360
+          if (desHeading >= 360){
+            desHeading = desHeading - 360;              // Adjust value if result is 360 or more
           }
           mFunc = cmdRequest.direction;
+          break;
         case LEFT:
           desHeading = curHeading - cmdRequest.value1;  // Subtract turn degrees from current heading
           if (desHeading < 0){
             desHeading = desHeading + 360;              // Adjust value if result is negative
           }
           mFunc = cmdRequest.direction;
+          break;
         case FACE:
           desHeading = cmdRequest.value1;
           int angleDiff = compass_diff(curHeading, desHeading); // Diff between current & Desired heading
@@ -291,39 +1576,182 @@ struct cmd_struct motorCommand(struct cmd_struct cmdRequest){
           }
       }
       break;
+    case  GOTO:
+      if(mFunc == GOTO){                                // Carry on from the last waypoint
+        pathFromX = pathToX;
+        pathFromY = pathToY;
+      } else {                                          //  or start from where we are.
+        poseRead(&now);
+        if(setPosReq){                                  // SETPOS not applied yet
+          now.xPos = setPosX;
+          now.yPos = setPosY;
+        }
+        pathFromX = now.xPos * PATH_SCALE;
+        pathFromY = now.yPos * PATH_SCALE;
+        integral = 0.0;                                 // Reset Integral to zero.
+        if(mFunc != FORWARD)
+          profVel = profAcc = 0;                        // Start from rest, else carry on smoothly.
+      }
+      pathToX = cmdRequest.value1 * PATH_SCALE;
+      pathToY = cmdRequest.value2 * PATH_SCALE;
+      des_vel_clicks = CLICKS_OF(abs(cmdRequest.direction) > V_MAX ? V_MAX : abs(cmdRequest.direction));
+      desInchDist = curInchDist = 0.0;                  // Route, not distance, ends the move.
+      mFunc = GOTO;
+      break;
+    case  TUNE:
+      tuneResult = 0;
+      mFunc = TUNE;                                     // Tune gains at the next interval.
+      break;
+    case  FFCAL:
+      ffResult = 0;
+      mFunc = FFCAL;                                    // Calibrate feed forward at the next interval.
+      break;
     case  BIAS:
-      des_bias_clicks = CLICKS * cmdRequest.value1;     // Express bias in clicks per interval.
+      des_bias_clicks = CLICKS_OF(cmdRequest.value1);   // Express bias in clicks per interval.
       break;
     case  MODE:
       mMode = cmdRequest.value1;                        // Establish motor control mode.
       break;
     case  SETPOS:
-      gps.xPos = cmdRequest.value1;                     // Set/Reset global x position coordinate.
-      gps.yPos = cmdRequest.value2;                     // Set/Reset global y position coordinate.
-      gps.gHeading = compass_smplHeading();             // Get current global heading from compass.
-      if (gps.xPos==0 && gps.yPos==0){                  // If setting the origin location...
-        gps.rHeading = 0;                               //  Set relative heading to zero.
-        orgHeading = gps.gHeading;                      //  Remember origin compass heading.
-      }
+      setPosX = cmdRequest.value1;                      // The motor cog owns gps, so it applies
+      setPosY = cmdRequest.value2;                      //  the new position (and heading) at
+      setPosReq = 1;                                    //  its next control interval.
       break;
     case  GETPOS:
-      while(gps.validPos == 0){                         // If semaphore flag False,
-        pause(1);                                       //  wait a moment and try again.
-      }
+      poseRead(&now);                                   // Consistent snapshot, no waiting
       cmdResult.action = mFunc;
-      cmdResult.direction = gps.gHeading;
-      cmdResult.value1 = gps.xPos;
-      cmdResult.value2 = gps.yPos;
-      return(cmdResult);                                // Return pointer to valid gps structure.
+      cmdResult.direction = now.gHeading;
+      cmdResult.value1 = now.xPos;
+      cmdResult.value2 = now.yPos;
+      return(cmdResult);                                // Return current position.
       break;
     case  GETFUNC:
       cmdResult.action = mFunc;
       return(cmdResult);                                // Return current motor function
       break;
     case  STOP:
+      flushTo = qHead;                                  // Drop everything queued so far.
+      flushDirect = directSeq;                          // Later direct commands are kept.
+      QUEUE_BARRIER();
+      flushReq++;
       mFunc = STOP;                                     // Set motor function to Stop
       break;
   }    
+  cmdResult.action = mFunc;
+  return(cmdResult);
+}
+
+/*
+ *  Generic robot command structure interface.
+ *  Commands that set mFunc bump directSeq before their other writes,
+ *  so a flush of the queue for an earlier STOP sees them and leaves
+ *  mFunc alone.
+ */
+struct cmd_struct motorCommand(struct cmd_struct cmdRequest){
+  switch(cmdRequest.action){
+    case MOVE: case TURN: case GOTO: case TUNE: case FFCAL:
+      directSeq++;
+      QUEUE_BARRIER();
+  }
+  return(runCommand(cmdRequest));
+}
+
+/* Current motor function, STOP if idle or STALL if a wheel stalled or slipped */
+int motorGetFunction(void){
+  return(mFunc);
+}
+
+/* The single command calls, each a direct motorCommand() */
+static struct cmd_struct command(int action, int direction, int value1, int value2){
+  struct cmd_struct cmd;
+
+  cmd.action = action;
+  cmd.direction = direction;
+  cmd.value1 = value1;
+  cmd.value2 = value2;
+  return(motorCommand(cmd));
+}
+
+void  motorSetMode(unsigned char mode){
+  command(MODE, 0, mode, 0);
+}
+
+void  motorSetBias(int bias){
+  command(BIAS, 0, bias, 0);
 }
 
+void  motorMove(int dir, int vel, int dist){
+  command(MOVE, dir, vel, dist);
+}
+
+void  motorRotate(int dir, int deg){
+  command(TURN, dir, deg, 0);                       // RIGHT, LEFT or FACE a compass heading
+}
+
+int   motorStop(void){
+  return(command(STOP, 0, 0, 0).action);
+}
+
+/* Applied by the motor cog at its next interval, in whole inches */
+int   motorSetPosition(float x, float y){
+  return(command(SETPOS, 0, (int) x, (int) y).action);
+}
+
+/* The motor cog reads the compass every interval, so this just reports it */
+int   motorSetHeading(void){
+  return(motorGetPose().gHeading);
+}
+
+/* Return current Pose structure of gps coordinates */
+pose  motorGetPose(void){
+  struct pose now;
 
+  poseRead(&now);
+  return(now);
+}
+
+/* Total clicks counted by one wheel (0 Left, 1 Right), from any cog */
+unsigned long long motorGetClicks(int wheel){
+  unsigned long long clicks;
+  unsigned int seq;
+
+  do{
+    while((seq = totalSeq) & 1);                      // Update under way, a few microseconds
+    POSE_BARRIER();
+    clicks = encTotal[wheel ? 1 : 0];
+    POSE_BARRIER();
+  } while(seq != totalSeq);
+  return(clicks);
+}
+
+#ifdef MOTOR_BENCH
+/*
+ *  Control math benchmark.
+ *  Runs the odometry and PID updates (no servo, encoder or compass
+ *  I/O) over a fixed pattern of encoder readings and returns the
+ *  average clock cycles per control interval. Build once with and
+ *  once without MOTOR_FIXED to compare. Call it before
+ *  initMotorControl(); it leaves the motor state reset.
+ */
+int motorBench(int loops){
+  static const int clicks[8] = {3, 5, 4, 6, 2, 5, 4, 3};
+  unsigned int start, total = 0;
+  int i;
+
+  ffLine();                                         // Feed forward as initMotorControl() would
+  mFunc = FORWARD;
+  des_vel_clicks = CLICKS_OF(50);
+  setVel = des_vel_clicks * VEL_SCALE;
+  for(i = 0; i < loops; i++){
+    curHeading = (i * 7) % 360;                     // Some heading change every interval
+    start = CNT;
+    updatePose(clicks[i & 7], clicks[(i + 3) & 7]);
+    updatePower(clicks[i & 7] * VEL_SCALE, clicks[(i + 3) & 7] * VEL_SCALE);
+    total += CNT - start;
+  }
+  mFunc = STOP;
+  integral = 0;
+  mPower[0] = mPower[1] = 0;
+  return(total / loops);
+}
+#endif
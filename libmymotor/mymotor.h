@@ -21,14 +21,48 @@ extern "C" {
 
 /* Motor function constants */
 #define MOTOR_PRESENT                             // Motor control exists
-#define CTRL_INT    250                           // Control Interval pause in milliseconds
-#define K_INT       0.3                           // Integral error gain constant
-#define K_PRO       0.6                           // Proportional gain constant
-#define K_DRV       0.1                           // Derivative (slope) constant
+#ifndef CTRL_INT
+#define CTRL_INT    250                           // Control Interval in milliseconds (-DCTRL_INT=20..50
+#endif                                            //  for the high rate loop, see mymotor.cpp)
+#define CTRL_REF    250                           // Interval the gains and CLICKS are tuned for
+#define ENC_POLL_US 500                           // Encoder edge timestamp resolution (high rate loop)
+#define K_INT       0.15                          // Integral error gain constant (steering)
+#define K_PRO       0.25                          // Proportional gain constant
+#define K_DRV       0.4                           // Derivative (slope) constant, damps speed changes
 #define CLICKS      0.09                          // Clicks per interval based on 100% duty factor
 #define V_MAX       100                           // Maximum velocity percentage
 #define DIST_PER_CLICK  0.26                      // Inches traveled per encoder "click"
 #define DEG_PER_CLICK   3.438                     // Degrees turned per "click"
+#ifndef MOTOR_ACCEL
+#define MOTOR_ACCEL 100                           // Move acceleration limit (velocity % per second)
+#endif
+#ifndef MOTOR_JERK
+#define MOTOR_JERK  400                           // Move jerk limit (velocity % per second per second)
+#endif                                            // (-DMOTOR_ACCEL=2000 -DMOTOR_JERK=40000 for
+                                                  //  a near step, see motorsim.cpp)
+#define MOTOR_CREEP 20                            // Velocity % for the end of a distance move
+#define TURN_INT    10                            // Control interval while turning (ms)
+#define TURN_KP     50                            // Turn speed per degree of heading error (1/100 us)
+#define TURN_KD     10                            // Turn speed per deg/s of error rate (1/100 us)
+#define TURN_MIN    10                            // Minimum turn speed (us from servo center)
+#define TURN_MAX    90                            // Maximum turn speed (us from servo center)
+#define TUNE_POWER  50                            // Servo % for the gain tuning step
+#define TUNE_MS     3000                          // Gain tuning step length (ms)
+#define PATH_LOOK   8                             // Waypoint look ahead distance (inches)
+#define PATH_ARRIVE 1                             // Last waypoint reached within (inches)
+#define STALL_TICKS 2                             // Control intervals a wheel may stall or slip for
+#define STALL_RATIO 4                             // Stalled below 1/STALL_RATIO of the expected clicks
+#define STALL_MIN   2                             // Fewest expected clicks (per CTRL_REF) worth checking
+#define STALL_GAP   3                             // Expected clicks with no edge that mean a jam
+#define SLIP_DEG    20                            // Wheel vs compass turn over STALL_TICKS intervals
+#ifndef MOTOR_QUEUE
+#define MOTOR_QUEUE 8                             // Queued motor commands (power of 2)
+#endif
+                                                  // Build with -DMOTOR_FIXED for Q16.16 fixed
+                                                  //  point control math instead of float.
+                                                  // Build with -DDRIVE_COG to send the servo
+                                                  //  pulses from the motor cog (mydrive), one
+                                                  //  cog fewer than the servo library.
 
 // Motor Mode constants
 #define STR_MOTOR     0x00                        // Straight Motor control
@@ -41,19 +75,48 @@ extern "C" {
 #define PID_MOTOR     0x07                        // Proportional/Integral/Derivative CTRL (Default)
 
 // Global Positioning (dead reckoning) data structure
+// x is ahead of, and y to the left of, the robot's heading when the origin was set.
 struct pose {
-  int   validPos;                                 // Valid Position data if 1 (semaphore flag).
   float xPos;                                     // Robots current x coordinate from origin.
   float yPos;                                     // Robots current y coordinate from origin.
   int   rHeading;                                 // Robots current heading "relative" to origin.
   int   gHeading;                                 // Robots current "global" compass heading.
 };  
 
+#ifdef MOTOR_LOG
+/*
+ *  Telemetry log frame, one per control interval (build with
+ *  -DMOTOR_LOG). motorLogSend() sends LOG_SYNC, the 28 frame bytes
+ *  as laid out here (little endian), then their 8 bit sum.
+ *  motorlog.c on the host turns a capture into CSV.
+ */
+#include "serial.h"
+#ifndef MOTOR_LOG_SIZE
+#define MOTOR_LOG_SIZE 64                         // Logged control intervals (power of 2)
+#endif
+#define LOG_SYNC    0xA5                          // First byte of each frame sent
+#define LOG_FIXED   0x01                          // Pose is Q16.16, else float bits
+
+struct motorLog {
+  unsigned int   time;                            // CNT at the end of the interval
+  int            xPos;                            // Pose x & y, see LOG_FIXED
+  int            yPos;
+  short          vel[2];                          // Left/Right velocity (1/16 clicks per CTRL_REF)
+  short          err[2];                          // Left/Right setpoint minus velocity (same units)
+  short          heading;                         // Relative heading (degrees)
+  signed char    power[2];                        // Left/Right servo power (%)
+  unsigned char  func;                            // Motor function (FORWARD, LEFT, STOP...)
+  unsigned char  flags;                           // LOG_FIXED
+  unsigned short seq;                             // Intervals logged, gaps are dropped frames
+};
+#endif
+
 /* Global motor function prototypes */
 int  initMotorControl(void);                      // Start motor Control in a new cog.
 void  motorSetMode(unsigned char mode);           // Set the motor control mode (See motor mode constants).
 void  motorSetBias(int bias);                     // Set the L/R bias value to make robot swerve.
-int   motorGetFunction(void);                     // Return current motor function ("stop" if idle).
+int   motorGetFunction(void);                     // Return current motor function ("stop" if idle,
+                                                  //  STALL if a wheel stalled or slipped).
 
 void  motorMove(int dir, int vel, int dist=0);    // Motion Direction, Percentage velocity, & Distance.
 void  motorRotate(int dir, int deg);              // Rotate Left/Right specified number of degrees
@@ -63,7 +126,25 @@ int   motorStop(void);                            // Stop current motor function
 int   motorSetPosition(float x=0.0, float y=0.0); // Set robot's current position to specified values
 int   motorSetHeading(void);                      // Update heading with current value from compass module
 pose  motorGetPose(void);                         // Return current Pose structure values
+unsigned long long motorGetClicks(int wheel);     // Total encoder clicks, 0 Left 1 Right (either way)
 struct cmd_struct motorCommand(struct cmd_struct cmdRequest);
+unsigned int motorQueue(struct cmd_struct cmd);   // Queue a command, returns its sequence number (0 if full)
+int   motorDone(unsigned int seq);                // TRUE once a queued command has finished
+int   motorWait(unsigned int seq, int timeoutMs=0); // Wait for a queued command, FALSE on timeout
+unsigned int motorFollow(const int path[][2], int count, int vel); // Queue x-y waypoints (GOTO)
+int   motorTune(void);                            // Tune and save control gains (drives ~1 foot)
+int   motorCalibrate(void);                       // Calibrate and save feed forward (drives ~2 feet & back)
+void  motorGetGains(int *kPro, int *kInt, int *kDrv); // Control gains in use (1/1000)
+int   motorHasGains(void);                        // TRUE if tuned gains are saved in EEPROM
+int   motorHasFeed(void);                         // TRUE if feed forward tables are saved in EEPROM
+#ifdef MOTOR_BENCH
+int   motorBench(int loops);                      // Average cycles per control calculation
+#endif
+#ifdef MOTOR_LOG
+int   motorLogRead(struct motorLog *frame);       // Oldest logged control interval, FALSE if none
+int   motorLogSend(serial *port, int max);        // Send up to max logged intervals, returns number sent
+unsigned int motorLogLost(void);                  // Intervals dropped because the log was full
+#endif
 
 
 #if defined(__cplusplus)
@@ -0,0 +1,146 @@
+/*
+ *  posestress - check that motorGetPose() never returns a torn pose.
+ *
+ *  Host side tool, not part of the Propeller library. mymotor.cpp is
+ *  included whole so a writer thread can call its updatePose() as the
+ *  motor cog does, while reader threads copy the pose through
+ *  motorGetPose() as other cogs do. The headers in sim/ stand in for
+ *  the Propeller libraries, as for motorsim:
+ *
+ *     c++ -O2 -pthread -Isim -I.. -I../libmycompass -I../libmytrig \
+ *         -include ../prop_pins.h -o posestress posestress.cpp \
+ *         ../libmycompass/mycompass.cpp ../libmytrig/mytrig.cpp
+ *     posestress [-u] [readers] [seconds]
+ *
+ *  Add -DMOTOR_FIXED as for the robot. Every update moves the robot
+ *  one click straight ahead and turns it DEG_PER_CLICK, and every
+ *  POSE_RESET updates SETPOS puts it back at the origin, so a whole
+ *  pose always has xPos = rHeading / 3 steps. A pose that is not is
+ *  torn: it prints FAIL and exits with 1. -u reads gps directly,
+ *  without the sequence counter, to show the check catches tearing.
+ *  Run it on a host with more cores than readers + 1.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include "mymotor.cpp"
+#include "simplei2c.h"
+
+#define POSE_RESET    100                           // Updates between SETPOS, keeps float error small
+#define POSE_READERS  2                             // Default reader threads
+#define POSE_SECS     3                             // Default run length
+
+volatile unsigned int PHSA, PHSB, FRQA, FRQB, CTRA, CTRB;
+unsigned int _clkfreq = 80000000;
+
+static volatile int done;
+static int    unguarded;
+static double xStep;                                // xPos moved by one update
+
+/* Propeller stand ins, nothing here reaches them but the linker */
+unsigned int sim_cnt(void){
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return((unsigned int)(t.tv_sec * 80000000ULL + t.tv_nsec * 2 / 25));
+}
+void  sim_waitcnt(unsigned int until){ while((int)(until - sim_cnt()) > 0); }
+int   cogstart(void (*func)(void *), void *par, void *stack, size_t stacksize){ return(-1); }
+void  pause(int ms){}
+void  ee_putByte(unsigned char value, int addr){}
+char  ee_getByte(int addr){ return(0); }
+void  ee_putInt(int value, int addr){}
+int   ee_getInt(int addr){ return(0); }
+int   servo_set(int pin, int time){ return(0); }
+int   servo_speed(int pin, int speed){ return(0); }
+i2c  *i2c_newbus(int sclPin, int sdaPin, int sclDrive){ return(NULL); }
+int   i2c_out(i2c *bus, int i2cAddr, int memAddr, int memAddrCount,
+              const unsigned char *data, int dataCount){ return(0); }
+int   i2c_in(i2c *bus, int i2cAddr, int memAddr, int memAddrCount,
+             unsigned char *data, int dataCount){ return(0); }
+
+/* Motor cog: pose updates, with SETPOS posted as another cog would */
+static void *writer(void *par){
+  struct cmd_struct cmd = {SETPOS, 0, 0, 0};
+  long  n;
+
+  for(n = 1; !done; n++){
+    updatePose(0, 1);
+    if(n % POSE_RESET == 0)
+      motorCommand(cmd);                            // Applied by the next update
+  }
+  return(NULL);
+}
+
+/* Another cog: copy the pose and check it is whole */
+static void *reader(void *par){
+  long *counts = (long *) par;                      // Reads & torn reads
+  struct pose p;
+  double expect;
+
+  while(!done){
+    if(unguarded){
+      p.rHeading = gps.rHeading;
+      p.xPos = gps.xPos;
+    } else
+      p = motorGetPose();
+    expect = p.rHeading / 3 * xStep;
+    if(p.rHeading % 3 != 0 || fabs(p.xPos - expect) > xStep / 4)
+      counts[1]++;
+    counts[0]++;
+  }
+  return(NULL);
+}
+
+int main(int argc, char *argv[]){
+  struct cmd_struct cmd = {SETPOS, 0, 0, 0};
+  struct timespec run = {0, 0};
+  pthread_t write, read[16];
+  long  counts[16][2] = {{0}}, reads = 0, torn = 0;
+  int   readers = POSE_READERS, secs = POSE_SECS, i, arg = 1;
+
+  if(arg < argc && strcmp(argv[arg], "-u") == 0){
+    unguarded = 1;
+    arg++;
+  }
+  if(arg < argc)
+    readers = atoi(argv[arg++]);
+  if(arg < argc)
+    secs = atoi(argv[arg++]);
+  if(readers < 1 || readers > 16){
+    fprintf(stderr, "posestress: 1 to 16 readers\n");
+    return(1);
+  }
+
+  motorCommand(cmd);                                // Measure one step from the origin
+  updatePose(0, 0);
+  updatePose(0, 1);
+  xStep = gps.xPos;
+  if(gps.rHeading != 3 || xStep <= 0){
+    fprintf(stderr, "posestress: one update gave %d deg, %f in\n", gps.rHeading, xStep);
+    return(1);
+  }
+  motorCommand(cmd);
+  updatePose(0, 0);
+
+  run.tv_sec = secs;
+  pthread_create(&write, NULL, writer, NULL);
+  for(i = 0; i < readers; i++)
+    pthread_create(&read[i], NULL, reader, counts[i]);
+  nanosleep(&run, NULL);
+  done = 1;
+  pthread_join(write, NULL);
+  for(i = 0; i < readers; i++){
+    pthread_join(read[i], NULL);
+    reads += counts[i][0];
+    torn += counts[i][1];
+  }
+  printf("%s: %d readers, %ld reads, %ld torn\n",
+         unguarded ? "unguarded" : "seqlock", readers, reads, torn);
+  if(torn && !unguarded){
+    printf("FAIL: torn pose read\n");
+    return(1);
+  }
+  return(0);
+}
@@ -0,0 +1,18 @@
+/* serial.h stand in for motorsim (host only), a port writes to a file */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct serial_sim serial;
+
+serial *serial_open(int rxpin, int txpin, int mode, int baudrate);
+int   serial_txChar(serial *port, int txbyte);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif
@@ -0,0 +1,16 @@
+/* servo.h stand in for motorsim (host only), pulses go to the wheel model */
+
+#ifndef SERVO_H
+#define SERVO_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int   servo_set(int pin, int time);               // Pulse width in us, 1500 is stopped
+int   servo_speed(int pin, int speed);            // Pulse width from 1500 in us
+
+#if defined(__cplusplus)
+}
+#endif
+#endif
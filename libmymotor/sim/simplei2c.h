@@ -0,0 +1,21 @@
+/* simplei2c.h stand in for motorsim (host only), the bus reaches the compass model */
+
+#ifndef SIMPLEI2C_H
+#define SIMPLEI2C_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct i2c_sim i2c;
+
+i2c  *i2c_newbus(int sclPin, int sdaPin, int sclDrive);
+int   i2c_out(i2c *bus, int i2cAddr, int memAddr, int memAddrCount,
+              const unsigned char *data, int dataCount);
+int   i2c_in(i2c *bus, int i2cAddr, int memAddr, int memAddrCount,
+             unsigned char *data, int dataCount);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif
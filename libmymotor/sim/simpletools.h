@@ -0,0 +1,45 @@
+/*
+ *  simpletools.h stand in for motorsim (host only).
+ *  Just the Propeller features mymotor.cpp and mycompass.cpp use.
+ *  CNT reads and waitcnt() run the simulated robot in motorsim.cpp,
+ *  and the counters are plain variables it adds encoder edges to.
+ */
+
+#ifndef SIMPLETOOLS_H
+#define SIMPLETOOLS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+extern volatile unsigned int PHSA, PHSB;          // Encoder counters
+extern volatile unsigned int FRQA, FRQB;
+extern volatile unsigned int CTRA, CTRB;
+extern volatile unsigned int OUTA, DIRA;          // Servo pins (DRIVE_COG)
+extern unsigned int _clkfreq;
+
+unsigned int sim_cnt(void);                       // CNT, a few clocks on each read
+void  sim_waitcnt(unsigned int until);            // Run the robot until CNT reaches until
+
+#define CNT         sim_cnt()
+#define CLKFREQ     _clkfreq
+#define waitcnt(t)  sim_waitcnt(t)
+
+int   cogstart(void (*func)(void *), void *par, void *stack, size_t stacksize);
+int   cogid(void);
+void  pause(int ms);
+
+void  ee_putByte(unsigned char value, int addr);
+char  ee_getByte(int addr);
+void  ee_putInt(int value, int addr);
+int   ee_getInt(int addr);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif
@@ -5,21 +5,174 @@
 #include  "mymtos.h"
 #include  "simpletools.h"
 
-void  arbitrate(void);
+struct cmd_struct moveOutput(struct cmd_struct cmd);
 void  cruise(void);
 void  avoid(void);
+void  sweep(void);
 
 int   moveInput     = 0;
 int   cruiseID      = 0;
-int   cruiseCommand = 0;
-int   cruiseFlag    = 0;
 int   avoidID       = 0;
-int   avoidCommand  = 0;
-int   avoidFlag     = 0;
+int   sweepID       = 0;
+int   sweepAngle    = 0;
+
+#define CRUISE_LEVEL  0                             // Arbiter levels, higher subsumes lower
+#define AVOID_LEVEL   1
+
+unsigned int sweep_stack[100];                      // Coroutine stack for sweep task
+
+#ifdef MTOS_BENCH
+/*
+ *  Dispatcher benchmark - build with -DMTOS_BENCH -DMAXTASKS=64 -DMAXSWITCHERS=4
+ *  Runs taskDispatch() directly (no switcher cog) against empty tasks
+ *  and reports dispatches per second and worst case dispatch latency
+ *  at 10, 32 and 64 tasks (limited by MAXTASKS). Then gives the tasks
+ *  some work and reports task throughput with 1 to 4 switcher cogs.
+ */
+#define BENCH_LOOPS 10000
+
+volatile int  benchWork = 0;                        // Busy loop count per task run
+volatile int  benchRuns[MAXTASKS];                  // Completed runs per task
+
+void  benchTask(void){
+  for(volatile int i = 0; i < benchWork; i++);
+  benchRuns[taskSelf()]++;
+}
+
+int   benchTotal(void){
+  int total = 0;
+
+  for(int i = 0; i < MAXTASKS; i++)
+    total += benchRuns[i];
+  return(total);
+}
+
+void  benchDispatch(void){
+  unsigned int  start, elapsed, total = 0, worst = 0;
+  unsigned int  overhead;
+
+  overhead = ~0;
+  for(int i = 0; i < 10; i++){                      // Cost of reading CNT itself, the
+    start = CNT;                                    //  least of a few as a host clock
+    elapsed = CNT - start;                          //  (mtossim.cpp) reads unevenly.
+    if(elapsed < overhead) overhead = elapsed;
+  }
+  for(int i = 0; i < BENCH_LOOPS; i++){
+    start = CNT;
+    taskDispatch();
+    elapsed = CNT - start;
+    elapsed = elapsed > overhead ? elapsed - overhead : 0;
+    total += elapsed;
+    if(elapsed > worst) worst = elapsed;
+  }
+  if(total == 0) total = 1;                         // Faster than the clock can tell
+  print("Dispatches/sec = %d, worst case = %d cycles\n",
+    (int)((long long)BENCH_LOOPS * CLKFREQ / total), worst);
+}
+
+/*
+ *  Mailbox stress test - a producer cog pushes numbered commands as
+ *  fast as it can while this cog pops them, checking none are lost,
+ *  repeated or out of order. Reports messages per second.
+ */
+#define BENCH_MSGS  20000
+
+struct mailbox  benchBox;
+unsigned int    producer_stack[(40 + (50 * 4))];
+
+void  benchProducer(void *par){
+  struct cmd_struct cmd = {MOVE, FORWARD, 0, 0};
+
+  for(cmd.value1 = 0; cmd.value1 < BENCH_MSGS; cmd.value1++){
+    while(!mboxPush(&benchBox, cmd));               // Spin while full
+  }
+  cogstop(cogid());                                 // Nothing more to send
+}
+
+void  benchMailbox(void){
+  struct cmd_struct cmd;
+  unsigned int start;
+  int   expect = 0, errors = 0;
+
+  mboxInit(&benchBox);
+  cogstart(&benchProducer, NULL, producer_stack, sizeof(producer_stack));
+  start = CNT;
+  while(expect < BENCH_MSGS){
+    if(mboxPop(&benchBox, &cmd)){
+      if(cmd.value1 != expect) errors++;            // Lost, repeated or reordered
+      expect = cmd.value1 + 1;
+    }
+  }
+  start = CNT - start;
+  print("Mailbox: %d msgs/sec, %d errors\n",
+    (int)((long long)BENCH_MSGS * CLKFREQ / start), errors);
+}
+
+/*
+ *  Event wakeup latency - time from taskPostEvent() to the waiting
+ *  task being dispatched, taken from its release jitter statistics.
+ */
+#define BENCH_EVENT 1
+
+void  benchWaiter(void){
+  taskWaitEvent(BENCH_EVENT);                       // Not run again until main posts
+}
+
+void  benchEvents(const char *label){
+  struct taskJitter jitter;
+  int   us = CLKFREQ / 1000000;
+  int   id = taskStart(benchWaiter, HIGH_PRI);
+
+  pause(10);                                        // Let it start waiting
+  for(int i = 0; i < 100; i++){
+    taskPostEvent(BENCH_EVENT);
+    pause(10);
+  }
+  taskGetJitter(id, &jitter);
+  print("%s: event wakeup min/avg/max = %d/%d/%d us\n", label,
+    jitter.minTicks / us, jitter.avgTicks / us, jitter.maxTicks / us);
+  taskRemove(id);
+}
 
+int main(){
+  int sizes[] = {10, 32, 64};
+  int started = 0;
+
+  for(int i = 0; i < 3 && sizes[i] <= MAXTASKS; i++){
+    while(started < sizes[i] && taskStart(benchTask, HIGH_PRI) >= 0)
+      started++;                                    // Grow task table to next size
+    print("%d tasks: ", started);
+    benchDispatch();
+  }
+
+  benchWork = 200;
+  for(int cogs = 1; cogs <= MAXSWITCHERS; cogs++){
+    if(initTaskSwitchers(cogs) < cogs) break;       // Out of cogs
+    int runs = benchTotal();
+    pause(1000);
+    print("%d switchers: %d task runs/sec\n", cogs, benchTotal() - runs);
+  }
+
+  benchMailbox();
+
+  taskRemove(0);                                    // Make room for the waiter
+  benchEvents("Busy switchers");
+  for(int id = 0; id < MAXTASKS; id++)
+    taskRemove(id);
+  benchEvents("Idle switchers");
+  return 0;
+}
+#else
 int main(){
   int loopcnt = 0;
+  struct taskJitter jitter;
+  struct taskCoStats costats;
+  struct taskLoad load;
+  struct arbStats arb;
   
+  arbInit(moveOutput);                              // motorCommand on the robot
+  arbAddBehavior(CRUISE_LEVEL);
+  arbAddBehavior(AVOID_LEVEL);
   initTaskSwitcher();
 
   /*
@@ -28,6 +181,12 @@ int main(){
    */
   cruiseID = taskStart(cruise, LOW_PRI);
   avoidID = taskStart(avoid, HIGH_PRI);
+  taskSetPeriodic(cruiseID, 20000);                 // Cruise every 20ms without drift
+  sweepID = taskStartCoroutine(sweep, sweep_stack, sizeof(sweep_stack), NORMAL_PRI);
+  arbStart(10000);                                  // Arbitrate every 10ms
+#ifdef MTOS_PROFILE
+  taskSetBudget(avoidID, 50);                       // Avoid should finish within 50us
+#endif
  
   /*
    * Body of main function loops endlessly looking for something to do and reacting
@@ -35,13 +194,14 @@ int main(){
    */
 
   while(1){
-    print("Let's check arbitration\n");
-    arbitrate();
-    print("moveInput = %d\n", moveInput);
+    arbGetStats(&arb);
+    print("moveInput = %d from level %d, %d forwarded, %d repeats dropped\n",
+      moveInput, arb.winner, arb.forwarded, arb.suppressed);
     print("Loop count = %d\n", loopcnt++);
     if(loopcnt > 10){
       print("Loop count triggered job held\n");
       taskSetStatus(avoidID, HELD);
+      arbRelease(AVOID_LEVEL);                      // Cruise takes over again
     }      
 //    if(loopcnt > 20){
 //      taskSetStatus(avoidID, 2000);
@@ -54,34 +214,59 @@ int main(){
       taskGetStatus(avoidID), 
       taskGetPriority(avoidID),
       taskGetState(avoidID));
+    taskGetJitter(cruiseID, &jitter);
+    print("Cruise releases = %d, jitter avg = %d max = %d ticks, missed = %d\n",
+      jitter.releases, jitter.avgTicks, jitter.maxTicks, jitter.missed);
+    taskGetCoroutineStats(sweepID, &costats);
+    print("Sweep angle = %d, switch avg = %d max = %d ticks, stack used %d of %d\n",
+      sweepAngle, costats.avgTicks, costats.maxTicks, costats.stackUsed, costats.stackSize);
+    taskGetLoad(0, &load);
+    print("Switcher busy %d%%\n", load.busyPercent);
+#ifdef MTOS_PROFILE
+    struct taskStats stats;
+    taskGetStats(avoidID, &stats);
+    print("Avoid runs = %d, min/avg/max = %d/%d/%d ticks, overruns = %d\n",
+      stats.calls, stats.minTicks, stats.avgTicks, stats.maxTicks, stats.overruns);
+#endif
     pause(500);
   }    
   
   return 0;
 }
+#endif
 
-void  arbitrate(void){
-  if(cruiseFlag == 1){
-    moveInput = cruiseCommand;
-  }    
-  if(avoidFlag == 1){
-    moveInput = avoidCommand;
-  }
-}      
+/* Arbiter output - stands in for motorCommand() */
+struct cmd_struct moveOutput(struct cmd_struct cmd){
+  moveInput = cmd.value1;
+  return(cmd);
+}
 
 void  cruise(void){
   int x = 0;
-  cruiseCommand = 21;
-  cruiseFlag = 1;
+  struct cmd_struct cmd = {MOVE, FORWARD, 21, 0};
+
+  arbPropose(CRUISE_LEVEL, cmd);
   x = taskGetState(cruiseID);
   taskSetState(cruiseID, x+=1);
 }
 
 void  avoid(void){
   int x = 0;
-  
-  avoidCommand = 41;
-  avoidFlag = 1;
+  struct cmd_struct cmd = {TURN, RIGHT, 41, 0};
+
+  arbPropose(AVOID_LEVEL, cmd);
   x = taskGetState(avoidID);
   taskSetState(avoidID, x+=1);
 }
+
+/*
+ *  Coroutine task - a long running loop that shares the switcher cog
+ *  by waiting cooperatively instead of calling pause().
+ */
+void  sweep(void){
+  while(1){
+    for(sweepAngle = 0; sweepAngle <= 180; sweepAngle += 10){
+      taskWaitUntil(CNT + CLKFREQ/20);              // 50ms per step, other tasks run meanwhile
+    }
+  }
+}
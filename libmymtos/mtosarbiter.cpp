@@ -0,0 +1,131 @@
+/*
+ *  Arbiter - subsumption style behavior arbitration.
+ *
+ *  Each behavior owns one level (0 .. MAXBEHAVIORS-1, higher levels
+ *  subsume lower ones) and publishes a proposed cmd_struct while it
+ *  wants control. The arbiter runs as a periodic mymtos task, picks
+ *  the highest active level from a bitmask and forwards its command
+ *  to the output function only when the winner or its command has
+ *  changed. A proposal therefore reaches the output within one
+ *  arbiter period (plus release jitter) of being made.
+ */
+
+#include  "simpletools.h"
+#include  "mymtos.h"
+
+static struct cmd_struct  proposal[MAXBEHAVIORS];         // Latest command from each behavior
+static volatile unsigned int activeMask = 0;              // Behaviors wanting control
+static unsigned int       addedMask = 0;                  // Registered behaviors
+static struct cmd_struct  (*arbOutput)(struct cmd_struct cmd) = NULL;
+static struct cmd_struct  lastCmd;                        // Last command forwarded
+static int                lastWinner = NOTASK;            // Level that sent lastCmd
+static unsigned int       forwarded = 0;                  // Commands sent to the output
+static unsigned int       suppressed = 0;                 // Unchanged commands not sent
+static int                arb_lock = -1;                  // Hub lock guarding proposals
+
+static void arbLock(void){
+  if(arb_lock >= 0)
+    while(lockset(arb_lock));                       // Spin until we own the lock
+}
+
+static void arbUnlock(void){
+  if(arb_lock >= 0)
+    lockclr(arb_lock);
+}
+
+/* Same command as last time? */
+static int sameCmd(struct cmd_struct *a, struct cmd_struct *b){
+  return(a->action == b->action && a->direction == b->direction &&
+         a->value1 == b->value1 && a->value2 == b->value2);
+}
+
+/* Set the function winning commands are sent to (e.g. motorCommand) */
+void arbInit(struct cmd_struct (*output)(struct cmd_struct cmd)){
+  if(arb_lock < 0)
+    arb_lock = locknew();                           // Behaviors may run on any cog
+  arbOutput = output;
+  lastWinner = NOTASK;
+}
+
+/* Register a behavior at a level. Returns the level, or NOTASK if taken or out of range */
+int arbAddBehavior(int level){
+  if(level < 0 || level >= MAXBEHAVIORS) return(NOTASK);
+  if(addedMask & (1u << level)) return(NOTASK);
+  addedMask |= 1u << level;
+  return(level);
+}
+
+/* Propose a command and take part in arbitration */
+int arbPropose(int level, struct cmd_struct cmd){
+  if(level < 0 || level >= MAXBEHAVIORS) return(FALSE);
+  if(!(addedMask & (1u << level))) return(FALSE);
+  arbLock();
+  proposal[level] = cmd;
+  activeMask |= 1u << level;
+  arbUnlock();
+  return(TRUE);
+}
+
+/* Stop proposing; lower levels take over at the next arbitration */
+int arbRelease(int level){
+  if(level < 0 || level >= MAXBEHAVIORS) return(FALSE);
+  arbLock();
+  activeMask &= ~(1u << level);
+  arbUnlock();
+  return(TRUE);
+}
+
+/*
+ *  Arbitrate once.
+ *  Returns the winning level, or NOTASK if no behavior is active
+ *  (the last command is then left standing).
+ */
+int arbitrate(void){
+  struct cmd_struct cmd;
+  int   level;
+
+  arbLock();
+  if(activeMask == 0){
+    arbUnlock();
+    return(NOTASK);
+  }
+  level = 31 - __builtin_clz(activeMask);           // Highest active level wins
+  cmd = proposal[level];
+  arbUnlock();
+
+  if(level == lastWinner && sameCmd(&cmd, &lastCmd)){
+    suppressed++;                                   // Nothing new for the output
+    return(level);
+  }
+  lastCmd = cmd;
+  lastWinner = level;
+  forwarded++;
+  if(arbOutput != NULL)
+    arbOutput(cmd);
+  return(level);
+}
+
+static void arbTask(void){
+  arbitrate();
+}
+
+/*
+ *  Run the arbiter as a high priority task every periodUs.
+ *  Returns its task ID, or NOTASK if the task table is full.
+ */
+int arbStart(int periodUs){
+  int id = taskStart(arbTask, HIGH_PRI);
+
+  if(id != NOTASK)
+    taskSetPeriodic(id, periodUs);
+  return(id);
+}
+
+/* Arbitration counters */
+int arbGetStats(struct arbStats *stats){
+  stats->winner = lastWinner;
+  stats->activeMask = activeMask;
+  stats->forwarded = forwarded;
+  stats->suppressed = suppressed;
+  return(TRUE);
+}
@@ -0,0 +1,79 @@
+/*
+ *  Mailboxes - lock free single producer / single consumer queues
+ *  of cmd_struct commands, for passing commands between tasks and
+ *  between cogs without hub locks.
+ *
+ *  One side (task or cog) only ever pushes and the other side only
+ *  ever pops. The producer alone writes head and the consumer alone
+ *  writes tail, so neither needs a lock. Both count up forever and
+ *  wrap harmlessly; head - tail is the number of queued commands.
+ */
+
+#include  "simpletools.h"
+#include  "mymtos.h"
+
+/*
+ *  Hub RAM reads and writes complete in program order on the
+ *  Propeller, so only the compiler has to be kept from moving the
+ *  slot copy past the index update.
+ */
+#define MBOX_BARRIER()  __asm__ volatile ("" : : : "memory")
+
+/* Empty a mailbox (only while neither side is using it) */
+void mboxInit(struct mailbox *mb){
+  mb->head = 0;
+  mb->tail = 0;
+}
+
+/* Number of commands waiting in a mailbox */
+int mboxCount(struct mailbox *mb){
+  return(mb->head - mb->tail);
+}
+
+/* Queue a command. Returns TRUE, or FALSE if the mailbox is full */
+int mboxPush(struct mailbox *mb, struct cmd_struct cmd){
+  unsigned int head = mb->head;
+
+  if(head - mb->tail >= MBOX_SIZE)
+    return(FALSE);                                  // Full, caller decides what to do
+  mb->slot[head & (MBOX_SIZE - 1)] = cmd;
+  MBOX_BARRIER();                                   // Command is in place before it is
+  mb->head = head + 1;                              //  made visible to the consumer.
+  taskWake();                                       // Let an idle switcher look again
+  return(TRUE);
+}
+
+/* Take the oldest command. Returns TRUE, or FALSE if the mailbox is empty */
+int mboxPop(struct mailbox *mb, struct cmd_struct *cmd){
+  unsigned int tail = mb->tail;
+
+  if(mb->head == tail)
+    return(FALSE);
+  MBOX_BARRIER();
+  *cmd = mb->slot[tail & (MBOX_SIZE - 1)];
+  MBOX_BARRIER();                                   // Slot is copied out before the
+  mb->tail = tail + 1;                              //  producer may reuse it.
+  return(TRUE);
+}
+
+/*
+ *  Wait for a command.
+ *  A coroutine task yields to the other tasks while it waits; any
+ *  other caller waits in its own cog. A timeout of zero waits
+ *  forever. Returns TRUE with the command, or FALSE on timeout.
+ *  (A run to completion task should use mboxPop() instead.)
+ */
+int mboxWait(struct mailbox *mb, struct cmd_struct *cmd, int timeoutMs){
+  unsigned int start = CNT;
+  unsigned int limit = timeoutMs * (CLKFREQ / 1000);
+
+  while(!mboxPop(mb, cmd)){
+    if(timeoutMs > 0 && CNT - start >= limit)
+      return(FALSE);
+    if(taskSelf() != NOTASK)
+      taskYield();                                  // Let the rest of the switcher run
+    else
+      waitcnt(CNT + CLKFREQ / 100000);              // Poll the hub every 10us
+  }
+  return(TRUE);
+}
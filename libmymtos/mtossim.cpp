@@ -0,0 +1,152 @@
+/*
+ *  mtossim - run the mymtos kernel and its benchmark on the host.
+ *
+ *  Host side tool, not part of the Propeller library. mymtos.cpp and
+ *  the MTOS_BENCH build of libmymtos.cpp are compiled as they are;
+ *  sim/simpletools.h and this file stand in for the Propeller
+ *  library. Each cog is a thread, hub locks are atomic flags and CNT
+ *  counts at CLKFREQ from the host clock:
+ *
+ *     c++ -O2 -pthread -Isim -I.. -DMTOS_BENCH -DMAXTASKS=64 \
+ *         -DMAXSWITCHERS=4 -DMTOS_HUB_BUDGET=65536 -o mtosbench \
+ *         mtossim.cpp libmymtos.cpp mymtos.cpp mtosmailbox.cpp mtosarbiter.cpp
+ *     mtosbench
+ *
+ *  (Host pointers are twice the size, so the task table needs a
+ *  larger MTOS_HUB_BUDGET than the robot.)
+ *
+ *  It prints what the robot prints: dispatches per second and the
+ *  worst dispatch at 10, 32 & 64 tasks, task runs per second with 1
+ *  to 4 switchers, mailbox messages per second and event wakeup
+ *  latency. The figures are in Propeller clocks and microseconds but
+ *  measure the host, so compare them with each other (before and
+ *  after a change, 1 switcher against 4), not with the robot. Host
+ *  threads get preempted, which shows in the worst case figures. The
+ *  benchmark needs a host core for each switcher, main and the
+ *  mailbox producer (six at MAXSWITCHERS=4). With fewer, the busy
+ *  switchers starve the others, and the scaling, mailbox and wakeup
+ *  figures measure the host scheduler instead. On a one core host:
+ *
+ *     1 switchers: 1626673 task runs/sec
+ *     2 switchers: 1353461 task runs/sec
+ *     3 switchers: 1236375 task runs/sec
+ *     4 switchers: 1303288 task runs/sec
+ *
+ *  which is time slicing, not the switchers' scaling; that has not
+ *  been measured yet.
+ */
+
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include "simpletools.h"
+
+#define SIM_COGS    8                               // As many cogs as the Propeller
+
+unsigned int _clkfreq = 80000000;
+
+static int          cogsUsed = 1;                   // main() is cog 0
+static __thread int cogSelf = 0;
+static volatile int lockUsed[8];
+static volatile int lockFlag[8];
+
+struct cogStart {
+  void  (*func)(void *);
+  void  *par;
+  int   cog;
+};
+
+unsigned int sim_cnt(void){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return((unsigned int)(now.tv_sec * (unsigned long long) _clkfreq +
+                        now.tv_nsec * (unsigned long long) _clkfreq / 1000000000));
+}
+
+void sim_waitcnt(unsigned int until){
+  struct timespec nap = {0, 0};
+  int   left;
+
+  while((left = (int)(until - sim_cnt())) > 0){
+    if(left > (int)(_clkfreq / 10000)){             // Sleep off all but the last 100us
+      nap.tv_nsec = (long)((left - _clkfreq / 10000) * 1000000000ULL / _clkfreq);
+      nanosleep(&nap, NULL);
+    }
+  }
+}
+
+void pause(int ms){
+  sim_waitcnt(sim_cnt() + ms * (_clkfreq / 1000));
+}
+
+static void *cogRun(void *arg){
+  struct cogStart start = *(struct cogStart *) arg;
+
+  free(arg);
+  cogSelf = start.cog;
+  start.func(start.par);
+  return(NULL);
+}
+
+/* A new thread for each cog, the stack given is not used */
+int cogstart(void (*func)(void *), void *par, void *stack, size_t stacksize){
+  struct cogStart *start;
+  pthread_t thread;
+  int   cog = __sync_fetch_and_add(&cogsUsed, 1);
+
+  if(cog >= SIM_COGS)
+    return(-1);                                     // No cog free
+  start = (struct cogStart *) malloc(sizeof(*start));
+  start->func = func;
+  start->par = par;
+  start->cog = cog;
+  if(pthread_create(&thread, NULL, cogRun, start) != 0)
+    return(-1);
+  pthread_detach(thread);
+  return(cog);
+}
+
+int cogid(void){
+  return(cogSelf);
+}
+
+void cogstop(int id){
+  if(id == cogSelf && id != 0)
+    pthread_exit(NULL);
+}
+
+int locknew(void){
+  int   i;
+
+  for(i = 0; i < 8; i++)
+    if(__sync_lock_test_and_set(&lockUsed[i], 1) == 0)
+      return(i);
+  return(-1);
+}
+
+void lockret(int lock){
+  __sync_lock_release(&lockUsed[lock]);
+}
+
+int lockset(int lock){
+  return(__sync_lock_test_and_set(&lockFlag[lock], 1));
+}
+
+int lockclr(int lock){
+  int   was = lockFlag[lock];
+
+  __sync_lock_release(&lockFlag[lock]);
+  return(was);
+}
+
+int print(const char *format, ...){
+  va_list args;
+  int   n;
+
+  va_start(args, format);
+  n = vprintf(format, args);
+  va_end(args);
+  fflush(stdout);
+  return(n);
+}
@@ -0,0 +1,54 @@
+/*
+ *  Pin watchers - helper cogs that sleep in waitpne until an input
+ *  pin changes and then post events to mymtos tasks. A task waiting
+ *  on a bump switch, encoder or serial start bit with taskWaitEvent()
+ *  costs nothing until the edge arrives.
+ */
+
+#include  "simpletools.h"
+#include  "mymtos.h"
+
+struct  pinWatch{
+  unsigned int  mask;                               // Pin being watched
+  int           edge;                               // EDGE_RISE, EDGE_FALL or EDGE_BOTH
+  unsigned int  events;                             // Events posted on each edge
+};
+
+static struct pinWatch  watch[MTOS_WATCHERS];
+static int              numWatchers = 0;
+
+// Stack space for each pin watcher cog
+unsigned int watch_stack[MTOS_WATCHERS][(40 + (25 * 4))];
+
+static void pinWatcher(void *par){
+  struct pinWatch *w = (struct pinWatch *) par;
+  unsigned int level = INA & w->mask;
+
+  while(1){
+    waitpne(level, w->mask);                        // Cog idles until the pin changes
+    level ^= w->mask;
+    if(w->edge & (level ? EDGE_RISE : EDGE_FALL))
+      taskPostEvent(w->events);
+  }
+}
+
+/*
+ *  Watch a pin.
+ *  Starts a cog that posts events each time pin sees the given edge
+ *  (EDGE_RISE, EDGE_FALL or EDGE_BOTH). Returns the cog ID, or -1 if
+ *  MTOS_WATCHERS are already running or no cog is free.
+ */
+int taskWatchPin(int pin, int edge, unsigned int events){
+  int n, cog;
+
+  if(numWatchers >= MTOS_WATCHERS || pin < 0 || pin > 31)
+    return(-1);
+  n = numWatchers;
+  watch[n].mask = 1 << pin;
+  watch[n].edge = edge;
+  watch[n].events = events;
+  cog = cogstart(&pinWatcher, &watch[n], watch_stack[n], sizeof(watch_stack[n]));
+  if(cog >= 0)
+    numWatchers++;
+  return(cog);
+}
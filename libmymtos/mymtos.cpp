@@ -7,72 +7,715 @@
  *    - All tasks (functions) run to completion before yielding
  *    - A function must provide for external state determination
  *      if it runs longer than a single iteration
+ *    - Optional coroutine tasks keep their own stack and may
+ *      yield part way through with taskYield()/taskWaitUntil()
  *      
  */
 
 #include  "simpletools.h"
 #include  "mymtos.h"
 
+#define IDLE_MARGIN   400                           // Shortest idle waitcnt (ticks) worth making
+
+struct  taskContext;
+
+#if MTOS_COROUTINES
+#include  <setjmp.h>
+
+/*
+ *  Coroutine context.
+ *  Kept at the low end of the stack handed to taskStartCoroutine();
+ *  the task's own stack grows down from the top of the same block
+ *  towards it. Unused stack is pre-filled so the high-water mark
+ *  can be found later.
+ */
+#define STACK_FILL    0x5A5A5A5A                    // Unused coroutine stack pattern
+
+struct  taskContext{
+  jmp_buf       regs;                               // Saved registers while task is yielded
+  unsigned int  *stackLow;                          // Lowest usable stack long
+  unsigned int  *stackTop;                          // Initial stack pointer
+  int           started;                            // Task has been entered on its own stack
+  unsigned int  swStart;                            // CNT when the current switch began
+  unsigned int  swCount;                            // Context switches measured
+  unsigned int  swMax;                              // Slowest context switch in ticks
+  unsigned long long swTotal;                       // Sum of context switch ticks
+};
+
+#if defined(__PROPELLER__)
+#define SET_STACK(top)  __asm__ volatile ("mov sp, %0" : : "r" (top))
+#elif defined(__x86_64__)                           // Host build, see mtossim.cpp
+#define SET_STACK(top)  __asm__ volatile ("mov %0, %%rsp" : : "r" (top))
+#elif defined(__aarch64__)
+#define SET_STACK(top)  __asm__ volatile ("mov sp, %0" : : "r" (top))
+#else
+#error "mymtos coroutines need a stack switch for this target"
+#endif
+#endif
+
 /*
  *taskStruct definition
  *  jobID = taskList index
  *  jobPointer = address of function to run
  *  jobStatus = Runable, Held, Sleeping
- *  jobDelay = CNT + (CLKFREQ * #ofSeconds)
+ *  jobDelay = CNT value at which the task is (or was last) released
  *  jobPriority = High, Normal, Low
  *  jobState = Finite State Machine index used by task if necessary
+ *  jobNext = Next task in the sleep list (ordered by jobDelay)
+ *  jobPeriod = Clock ticks between periodic releases (0 = not periodic)
+ *  jit... = Release jitter (dispatch CNT - jobDelay) statistics
+ *  jobContext = Coroutine context (NULL for run to completion tasks)
+ *  jobCog = Switcher (run queue) the task currently belongs to
+ *  evtMask = Events a Waiting task is waiting for
+ *  evtGot = Events that released the task, until read by taskGetEvents()
+ *  prf... = Execution time profile (only when built with MTOS_PROFILE)
+ *  The jit... fields and jobContext are left out when MTOS_JITTER or
+ *  MTOS_COROUTINES is 0. With 4 byte longs an entry is 72 bytes, or
+ *  44 bytes with both 0 (sizeof, gcc -m32, without MTOS_PROFILE).
  */
 struct  taskStruct{
   int   jobID;                                      // job (task) ID.
   void  (*jobPointer)(void);                        // Pointer to task function
   int   jobStatus;                                  // Runable, Held, etc.
-  int   jobDelay;                                   // Delay task until systemtime exceeds
+  unsigned int jobDelay;                            // Delay task until systemtime exceeds
   int   jobPriority;                                // Higher Priority tasks run more often
   int   jobState;                                   // Finite state per task iterations
+  int   jobNext;                                    // Next sleeping task (NOTASK = end of list)
+  unsigned int jobPeriod;                           // Periodic release interval in ticks
+#if MTOS_JITTER
+  int   jitCount;                                   // Number of timed releases measured
+  unsigned int jitMin;                              // Smallest release latency in ticks
+  unsigned int jitMax;                              // Largest release latency in ticks
+  unsigned long long jitTotal;                      // Sum of release latencies in ticks
+  int   jitMissed;                                  // Periodic releases skipped by overruns
+#endif
+#if MTOS_COROUTINES
+  struct taskContext *jobContext;                   // Coroutine context, if any
+#endif
+  int   jobCog;                                     // Owning switcher index
+  unsigned int evtMask;                             // Events being waited for
+  unsigned int evtGot;                              // Events received
+#ifdef MTOS_PROFILE
+  unsigned int prfBudget;                           // Allowed ticks per run (0 = no limit)
+  unsigned int prfCalls;                            // Number of runs
+  unsigned int prfMin;                              // Shortest run in ticks
+  unsigned int prfMax;                              // Longest run in ticks
+  unsigned long long prfTotal;                      // Sum of run times in ticks
+  unsigned int prfOverruns;                         // Runs longer than prfBudget
+#endif
 };  
 
+/*
+ *  Ready task bitmaps.
+ *  One bit per jobID, one bitmap per priority class. A task is only
+ *  present in a bitmap while it is Runable, so Held and Sleeping
+ *  tasks cost the dispatcher nothing.
+ */
+#if MAXTASKS > 64
+#error "mymtos supports at most 64 tasks"
+#elif MAXTASKS > 32
+typedef unsigned long long taskMask;
+#define TASK_BIT(id)    (1ULL << (id))
+#define FIRST_TASK(m)   __builtin_ctzll(m)          // Lowest jobID present in mask
+#define COUNT_TASKS(m)  __builtin_popcountll(m)
+#else
+typedef unsigned int taskMask;
+#define TASK_BIT(id)    (1U << (id))
+#define FIRST_TASK(m)   __builtin_ctz(m)            // Lowest jobID present in mask
+#define COUNT_TASKS(m)  __builtin_popcount(m)
+#endif
+#define ALL_TASKS   ((taskMask) ~(taskMask) 0 >> (sizeof(taskMask) * 8 - MAXTASKS))
+
+/*
+ *  switcherStruct definition - one run queue per task switcher cog.
+ *  Each Runable task belongs to exactly one switcher's readyMask.
+ *  A switcher that finds nothing due steals a due task from the
+ *  busiest other switcher's passMask, which moves the task over.
+ *  Coroutines stay with the switcher that first runs them.
+ */
+struct  switcherStruct{
+  volatile taskMask readyMask[LOW_PRI+1];           // Runable tasks owned, per priority class
+  volatile taskMask passMask[LOW_PRI+1];            // Tasks still due in the current pass
+  volatile taskMask wokeMask[LOW_PRI+1];            // Tasks released from sleep for next pass
+  volatile taskMask timedMask;                      // Woken tasks awaiting a jitter sample
+  volatile taskMask eventMask;                      // Tasks released by an event, run first
+  volatile int      currentTask;                    // Task being run by this switcher
+  int               execLoop;                       // Tracks passes through kernel
+                                                    //  to control task priorities.
+  int               cogID;                          // Cog running this switcher
+#if MTOS_COROUTINES
+  jmp_buf           switchContext;                  // Switcher registers while a coroutine runs
+#endif
+  unsigned long long busyTicks;                     // Time spent running tasks
+  unsigned long long idleTicks;                     // Time spent waiting with nothing to run
+};
+
 static volatile struct  taskStruct  taskList[MAXTASKS];   // Array of task Entries
-static volatile int     nextTask  = 0;                    // Next task entry (jobID).
+static volatile taskMask usedMask = 0;                    // taskList entries in use
+
+static struct switcherStruct switcher[MAXSWITCHERS];      // Run queue per switcher cog
+static volatile int       numSwitchers = 0;               // Switcher cogs started
+static signed char        switcherOf[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+                                                          // Switcher index by cog ID
+static volatile int       sleepHead = NOTASK;             // Sleeping task with earliest jobDelay
+static volatile taskMask  coroutineMask;                  // Coroutine tasks (never stolen)
+static volatile taskMask  waitMask;                       // Tasks Waiting for an event
+static volatile unsigned int wakeCount = 0;               // Bumped whenever work may have appeared
+static int                mtos_lock = -1;                 // Hub lock guarding the ready/sleep lists
+static int                kernelReady = 0;                // Switcher queues initialized
+
+#define READY(id)   switcher[taskList[id].jobCog].readyMask[taskList[id].jobPriority]
+#define TASK_VALID(id)  ((id) >= 0 && (id) < MAXTASKS && (usedMask & TASK_BIT(id)))
+
+// Stack space for each task switcher cog
+unsigned int switch_stack[MAXSWITCHERS][MTOS_STACK];
+
+/*
+ *  Hub RAM check - fails to compile (negative array size) if the
+ *  task table, run queues and switcher stacks configured above need
+ *  more than MTOS_HUB_BUDGET bytes.
+ */
+typedef char mtosHubCheck[(sizeof(taskList) + sizeof(switcher) + sizeof(switch_stack)
+                           <= MTOS_HUB_BUDGET) ? 1 : -1];
+
+/*
+ *  Kernel list lock.
+ *  The ready bitmaps and sleep list are changed by the switcher cogs
+ *  and by any cog calling taskSetStatus(), so updates are made under
+ *  a hub lock once a switcher is running.
+ */
+static void kernelLock(void){
+  if(mtos_lock >= 0)
+    while(lockset(mtos_lock));                      // Spin until we own the lock
+}
+
+static void kernelUnlock(void){
+  if(mtos_lock >= 0)
+    lockclr(mtos_lock);
+}
+
+/*
+ *  Post a wake event.
+ *  Idle switchers check this between waits, so anything that makes a
+ *  task Runable or changes the sleep list calls it.
+ */
+void taskWake(void){
+  wakeCount++;
+}
+
+/* Set up the switcher run queues before the first task or switcher starts */
+static void kernelInit(void){
+  int sw;
+
+  if(kernelReady) return;
+  for(sw = 0; sw < MAXSWITCHERS; sw++){
+    switcher[sw].execLoop = 1;
+    switcher[sw].currentTask = NOTASK;
+    switcher[sw].cogID = -1;
+  }
+  kernelReady = 1;
+}
+
+/* Run queue of the calling cog (switcher 0 if taskDispatch() is called directly) */
+static struct switcherStruct *thisSwitcher(void){
+  int sw = switcherOf[cogid()];
+
+  return(&switcher[sw < 0 ? 0 : sw]);
+}
+
+/* Remove a task from the sleep list (caller holds kernel lock) */
+static void sleepUnlink(int id){
+  int prev = NOTASK;
+  int task = sleepHead;
+
+  while(task != NOTASK && task != id){
+    prev = task;
+    task = taskList[task].jobNext;
+  }
+  if(task == NOTASK) return;                        // Not in the sleep list
+  if(prev == NOTASK)
+    sleepHead = taskList[id].jobNext;
+  else
+    taskList[prev].jobNext = taskList[id].jobNext;
+  taskList[id].jobNext = NOTASK;
+}
+
+/*
+ *  Deadline test that survives CNT wrapping (every ~53s at 80MHz).
+ *  True once CNT has reached the release time, provided the release
+ *  is never more than 2^31 ticks away.
+ */
+static inline int releaseDue(unsigned int release){
+  return((int)(CNT - release) >= 0);
+}
+
+/* Insert a task into the sleep list in jobDelay order (caller holds kernel lock) */
+static void sleepInsert(int id){
+  int prev = NOTASK;
+  int task = sleepHead;
+
+  while(task != NOTASK &&                           // Signed difference keeps order across wrap
+        (int)(taskList[task].jobDelay - taskList[id].jobDelay) <= 0){
+    prev = task;
+    task = taskList[task].jobNext;
+  }
+  taskList[id].jobNext = task;
+  if(prev == NOTASK)
+    sleepHead = id;
+  else
+    taskList[prev].jobNext = id;
+}
+
+/*
+ *  Start a new pass through the kernel.
+ *  Wake any sleepers whose delay has expired (they run in their
+ *  switcher's next pass regardless of priority, as they always have)
+ *  and load the pass bitmaps from the priority classes due on this
+ *  execLoop.
+ */
+static void startPass(struct switcherStruct *sw){
+  int pri;
+  int task;
+  int other = FALSE;                                // Woke a task on another switcher
+  struct switcherStruct *home;
+
+  kernelLock();
+  while(sleepHead != NOTASK && releaseDue(taskList[sleepHead].jobDelay)){
+    task = sleepHead;                               // Earliest delay has expired
+    sleepHead = taskList[task].jobNext;
+    taskList[task].jobNext = NOTASK;
+    taskList[task].jobStatus = RUNABLE;             // Set task status back to Runable
+    home = &switcher[taskList[task].jobCog];
+    home->readyMask[taskList[task].jobPriority] |= TASK_BIT(task);
+    home->wokeMask[taskList[task].jobPriority] |= TASK_BIT(task);
+    home->timedMask |= TASK_BIT(task);              // Measure jitter when it is dispatched
+    if(home != sw)
+      other = TRUE;
+  }
+  for(pri = HIGH_PRI; pri <= LOW_PRI; pri++){
+    sw->passMask[pri] |= sw->wokeMask[pri];
+    sw->wokeMask[pri] = 0;
+    if(sw->execLoop % pri == 0)
+      sw->passMask[pri] |= sw->readyMask[pri];
+  }
+  kernelUnlock();
+  if(other)                                         // Its switcher may be in idleWait
+    taskWake();
+
+  if (sw->execLoop++ > 4)                           // The execLoop count cycles from
+    sw->execLoop = 1;                               //  1 to 4 to calculate job priority.
+}
+
+/*
+ *  Steal work for an idle switcher.
+ *  Takes the highest priority task still due in the busiest other
+ *  switcher's pass and makes it ours, ready to run in this pass.
+ */
+static void stealTask(struct switcherStruct *sw){
+  struct switcherStruct *victim = NULL;
+  int   most = 0, count, pri, i, task;
+  taskMask due;
+
+  kernelLock();
+  for(i = 0; i < numSwitchers; i++){                // Find the switcher furthest behind
+    if(&switcher[i] == sw) continue;
+    count = 0;
+    for(pri = HIGH_PRI; pri <= LOW_PRI; pri++)
+      count += COUNT_TASKS(switcher[i].passMask[pri] & ~coroutineMask);
+    if(count > most){
+      most = count;
+      victim = &switcher[i];
+    }
+  }
+  for(pri = HIGH_PRI; victim && pri <= LOW_PRI; pri++){
+    due = victim->passMask[pri] & ~coroutineMask;
+    if(due){
+      task = FIRST_TASK(due);                       // Move task to this switcher
+      victim->passMask[pri]  &= ~TASK_BIT(task);
+      victim->readyMask[pri] &= ~TASK_BIT(task);
+      sw->readyMask[pri] |= TASK_BIT(task);
+      sw->passMask[pri]  |= TASK_BIT(task);
+      if(victim->timedMask & TASK_BIT(task)){
+        victim->timedMask &= ~TASK_BIT(task);
+        sw->timedMask |= TASK_BIT(task);
+      }
+      taskList[task].jobCog = sw - switcher;
+      break;
+    }
+  }
+  kernelUnlock();
+}
+
+/* Put a task to sleep until a given CNT value (caller holds kernel lock) */
+static void sleepUntil(int id, unsigned int release){
+  if(taskList[id].jobStatus == SLEEPING)
+    sleepUnlink(id);
+  READY(id) &= ~TASK_BIT(id);
+  taskList[id].jobStatus = SLEEPING;
+  taskList[id].jobDelay = release;
+  sleepInsert(id);
+}
+
+/* Record how late a timed release was actually dispatched */
+static void recordJitter(int id){
+#if MTOS_JITTER
+  unsigned int late = CNT - taskList[id].jobDelay;
+
+  if(taskList[id].jitCount == 0 || late < taskList[id].jitMin)
+    taskList[id].jitMin = late;
+  if(late > taskList[id].jitMax)
+    taskList[id].jitMax = late;
+  taskList[id].jitTotal += late;
+  taskList[id].jitCount++;
+#endif
+}
+
+/*
+ *  Schedule the next release of a periodic task.
+ *  The next release is the previous release plus the period, never
+ *  "now" plus the period, so execution time does not accumulate as
+ *  drift. Releases already in the past are skipped and counted.
+ */
+static void periodicRelease(int id){
+  unsigned int release = taskList[id].jobDelay + taskList[id].jobPeriod;
+
+  while(releaseDue(release + taskList[id].jobPeriod)){
+    release += taskList[id].jobPeriod;              // Overran a whole period, skip it
+#if MTOS_JITTER
+    taskList[id].jitMissed++;
+#endif
+  }
+  kernelLock();
+  if(taskList[id].jobStatus == RUNABLE && taskList[id].jobPeriod)
+    sleepUntil(id, release);                        // Unless task changed its own status
+  kernelUnlock();
+}
+
+/* Convert a time in milliseconds or microseconds into clock ticks */
+static unsigned int sleepTicks(unsigned int time, unsigned int perSecond){
+  unsigned int tick = CLKFREQ / perSecond;          // Ticks per ms or per us
+
+  if(time > 0x7FFFFFFF / tick)                      // Longest wrap-safe delay is 2^31 ticks
+    return(0x7FFFFFFF);                             //  (about 26 seconds at 80MHz).
+  return(time * tick);
+}
+
+#ifdef MTOS_PROFILE
+/* Record the execution time of one run of a task */
+static void recordRun(int id, unsigned int ticks){
+  if(taskList[id].prfCalls == 0 || ticks < taskList[id].prfMin)
+    taskList[id].prfMin = ticks;
+  if(ticks > taskList[id].prfMax)
+    taskList[id].prfMax = ticks;
+  if(taskList[id].prfBudget && ticks > taskList[id].prfBudget)
+    taskList[id].prfOverruns++;
+  taskList[id].prfTotal += ticks;
+  taskList[id].prfCalls++;
+}
+#define PROFILE_START(t)    unsigned int t = CNT
+#define PROFILE_END(id, t)  recordRun(id, CNT - t)
+#else
+#define PROFILE_START(t)
+#define PROFILE_END(id, t)
+#endif
+
+#if MTOS_COROUTINES
+/* Account for one coroutine context switch (either direction) */
+static void recordSwitch(struct taskContext *ctx){
+  unsigned int ticks = CNT - ctx->swStart;
+
+  if(ticks > ctx->swMax)
+    ctx->swMax = ticks;
+  ctx->swTotal += ticks;
+  ctx->swCount++;
+}
+
+/*
+ *  First entry of a coroutine, already running on its own stack.
+ *  If the task function ever returns the task is Held; making it
+ *  Runable again starts it over from the top.
+ */
+static void coroutineEntry(void){
+  struct switcherStruct *sw = thisSwitcher();
+  int id = sw->currentTask;
+  struct taskContext *ctx = taskList[id].jobContext;
+
+  recordSwitch(ctx);
+  taskList[id].jobPointer();
+
+  kernelLock();
+  if(taskList[id].jobStatus == SLEEPING)
+    sleepUnlink(id);
+  taskList[id].jobStatus = HELD;
+  taskList[id].jobPeriod = 0;
+  READY(id) &= ~TASK_BIT(id);
+  kernelUnlock();
+  ctx->started = 0;
+  ctx->swStart = CNT;
+  longjmp(sw->switchContext, 1);                    // Back to the switcher, never returns
+}
+
+/* Run (or resume) a coroutine task until it yields */
+static void runCoroutine(struct switcherStruct *sw, int id){
+  struct taskContext *ctx = taskList[id].jobContext;
+
+  if(setjmp(sw->switchContext) == 0){
+    ctx->swStart = CNT;
+    if(ctx->started)
+      longjmp(ctx->regs, 1);                        // Resume where it yielded
+    ctx->started = 1;
+    SET_STACK(ctx->stackTop);                       // Switch to the task's stack
+    coroutineEntry();                               //  and enter it; never returns here.
+  }
+  recordSwitch(ctx);                                // Task yielded back to us
+}
+#endif
+
+/* True if this switcher has nothing Runable and nothing due */
+static int switcherIdle(struct switcherStruct *sw){
+  int pri;
+
+  for(pri = HIGH_PRI; pri <= LOW_PRI; pri++)
+    if(sw->readyMask[pri] | sw->passMask[pri] | sw->wokeMask[pri])
+      return(0);
+  return(1);
+}
+
+/* True if some other switcher has due work this one could steal */
+static int workToSteal(struct switcherStruct *sw){
+  int i;
+
+  for(i = 0; i < numSwitchers; i++)
+    if(&switcher[i] != sw &&
+       ((switcher[i].passMask[HIGH_PRI] | switcher[i].passMask[NORMAL_PRI] |
+         switcher[i].passMask[LOW_PRI]) & ~coroutineMask))
+      return(1);
+  return(0);
+}
+
+/*
+ *  Idle until there is work.
+ *  Blocks in waitcnt until the earliest sleeper is due, waking every
+ *  MTOS_IDLE_US to look for a wake event (taskWake) or, with several
+ *  switchers, work to steal. waitcnt leaves the hub to the other cogs
+ *  and lowers power draw compared to spinning through empty passes.
+ */
+static void idleWait(struct switcherStruct *sw){
+  unsigned int start = CNT;
+  unsigned int wake  = wakeCount;
+  unsigned int slice = CLKFREQ / 1000000 * MTOS_IDLE_US;
+  unsigned int until;
+  int head;
 
-// Stack space for Speed Control cog
-unsigned int switch_stack[(160 + (50 * 4))];
+  while(1){
+    until = CNT + slice;
+    head  = sleepHead;
+    if(head != NOTASK){
+      if(releaseDue(taskList[head].jobDelay))
+        break;                                      // Earliest sleeper is due
+      if((int)(taskList[head].jobDelay - until) < 0)
+        until = taskList[head].jobDelay;            // Due before this slice ends
+    }
+    if((int)(until - CNT) > IDLE_MARGIN)            // A CNT already passed would make
+      waitcnt(until);                               //  waitcnt wait for a whole roll-over.
+    if(wake != wakeCount || (numSwitchers > 1 && workToSteal(sw)))
+      break;
+  }
+  sw->idleTicks += CNT - start;
+}
+
+/*
+ *  Get switcher load.
+ *  Reports time spent running tasks and time spent idle in waitcnt
+ *  for one switcher cog (0 to MAXSWITCHERS-1), in clock ticks. What
+ *  is left over is kernel overhead (passes that found nothing due).
+ */
+int taskGetLoad(int sw, struct taskLoad *load){
+  unsigned long long total;
+
+  if(sw < 0 || sw >= MAXSWITCHERS) return(-1);
+  load->busyTicks = switcher[sw].busyTicks;
+  load->idleTicks = switcher[sw].idleTicks;
+  total = load->busyTicks + load->idleTicks;
+  load->busyPercent = total ? (int)(load->busyTicks * 100 / total) : 0;
+  return(load->busyPercent);
+}
 
 /* Start taskSwitcher function in separate cog*/
 int initTaskSwitcher(void){
-  int switch_cogID = cogstart(&taskSwitch, NULL, switch_stack, sizeof(switch_stack));
-  return(switch_cogID);
+  initTaskSwitchers(1);
+  return(switcher[0].cogID);
+}
+
+/*
+ *  Start task switcher cogs.
+ *  Brings the number of running switchers up to cogs (at most
+ *  MAXSWITCHERS) and returns how many are running. With more than
+ *  one switcher the task table is shared and idle switchers steal
+ *  due tasks from busy ones.
+ */
+int initTaskSwitchers(int cogs){
+  int sw;
+
+  kernelInit();
+  if(mtos_lock < 0)
+    mtos_lock = locknew();                          // Hub lock for cross-cog list updates
+  if(cogs > MAXSWITCHERS)
+    cogs = MAXSWITCHERS;
+  while(numSwitchers < cogs){
+    sw = numSwitchers++;                            // Counted before it starts, so running
+                                                    //  switchers lock before it can steal.
+    switcher[sw].cogID = cogstart(&taskSwitch, &switcher[sw],
+                                  switch_stack[sw], sizeof(switch_stack[sw]));
+    if(switcher[sw].cogID < 0){
+      numSwitchers--;                               // Out of cogs
+      break;
+    }
+  }
+  return(numSwitchers);
 }
 
 void taskSwitch(void *par){
-  int task = 0;
-  int execLoop = 1;                                 // Tracks loops through kernel
-                                                    //  to control task priorities.
+  struct switcherStruct *sw = (struct switcherStruct *) par;
+  unsigned int start;
 
+  switcherOf[cogid()] = sw - switcher;
   while (1){
-    for (task = 0; task < nextTask; task++){
-      switch(taskList[task].jobStatus){             // Based on current task status
-        case  RUNABLE:
-          if (execLoop % taskList[task].jobPriority == 0) {
-            taskList[task].jobPointer();            // Run current task
-          }            
-          break;
-          
-        case  SLEEPING:
-          if(CNT >= taskList[task].jobDelay){       // If current systemtime >= delaytime
-            taskList[task].jobDelay = 0;            // Reset Delay Time
-            taskList[task].jobStatus = RUNABLE;     // Set task status back to Runable
-            taskList[task].jobPointer();            // Run task
-          }
-          break;
-          
-        case  HELD:                                 // If current task is Held, skip it.
-        default:                                    // Undefined status, skip task.
-          break;
-      }
+    start = CNT;
+    if(taskDispatch() != NOTASK)
+      sw->busyTicks += CNT - start;
+    else if(switcherIdle(sw))
+      idleWait(sw);                                 // Nothing Runable, wait for a deadline
+  }
+}
+
+/*
+ *  Dispatch the next task.
+ *  Runs the highest priority task still due in the current pass and
+ *  returns its jobID, or NOTASK if nothing was due. Cost is constant:
+ *  one bitmap scan per priority class, independent of MAXTASKS.
+ */
+int taskDispatch(void){
+  struct switcherStruct *sw = thisSwitcher();
+  int pri;
+  int task = NOTASK;
+  int timed = FALSE;
+  int shared = numSwitchers > 1;                    // Other switchers may steal from us
+
+  if((sw->passMask[HIGH_PRI] | sw->passMask[NORMAL_PRI] | sw->passMask[LOW_PRI]) == 0){
+    startPass(sw);
+    if(shared && (sw->passMask[HIGH_PRI] | sw->passMask[NORMAL_PRI] | sw->passMask[LOW_PRI]) == 0)
+      stealTask(sw);
+  }
+
+  if(sw->eventMask){                                // Released by an event, run it now
+    kernelLock();                                   //  rather than waiting for a new pass.
+    if(sw->eventMask){
+      task = FIRST_TASK(sw->eventMask);
+      sw->eventMask &= ~TASK_BIT(task);
+      pri = taskList[task].jobPriority;
+      sw->passMask[pri] &= ~TASK_BIT(task);
+      if((sw->readyMask[pri] & TASK_BIT(task)) == 0)
+        task = NOTASK;
+    }
+    kernelUnlock();
+  }
+
+  if(shared) kernelLock();
+  for(pri = HIGH_PRI; pri <= LOW_PRI && task == NOTASK; pri++){
+    if(sw->passMask[pri]){
+      task = FIRST_TASK(sw->passMask[pri]);
+      sw->passMask[pri] &= ~TASK_BIT(task);
+      if((sw->readyMask[pri] & TASK_BIT(task)) == 0)
+        task = NOTASK;                              // Skip if Held/Slept since pass began
     }
-    if (execLoop++ > 4)                             // The execLoop count cycles from
-      execLoop = 1;                                 //  1 to 4 to calculate job priority.
   }
+  if(task != NOTASK && (sw->timedMask & TASK_BIT(task))){
+    sw->timedMask &= ~TASK_BIT(task);               // Under the lock, stealers change it too
+    timed = TRUE;
+  }
+  if(shared) kernelUnlock();
+  if(task == NOTASK)
+    return(NOTASK);
+
+  if(timed)
+    recordJitter(task);
+  sw->currentTask = task;
+  PROFILE_START(runStart);
+#if MTOS_COROUTINES
+  if(taskList[task].jobContext)
+    runCoroutine(sw, task);                         // Resume coroutine until it yields
+  else
+#endif
+    taskList[task].jobPointer();                    // Run current task
+  PROFILE_END(task, runStart);
+  sw->currentTask = NOTASK;
+  if(taskList[task].jobPeriod)
+    periodicRelease(task);
+  return(task);
+}
+
+/*
+ *  Fill in a free taskList entry and make it Runable.
+ *  The lowest free jobID is used. A removed task that is still
+ *  running keeps its entry until it returns.
+ */
+static int taskCreate(void (*func)(void), int priority, struct taskContext *ctx){
+  taskMask free;
+  int   id, sw;
+
+  kernelInit();
+  if(priority < HIGH_PRI || priority > LOW_PRI)
+    priority = NORMAL_PRI;
+  kernelLock();
+  free = ALL_TASKS & ~usedMask;
+  for(sw = 0; sw < MAXSWITCHERS; sw++)
+    if(switcher[sw].currentTask != NOTASK)
+      free &= ~TASK_BIT(switcher[sw].currentTask);
+  if(free == 0){
+    kernelUnlock();
+    return -1;                                      // Return - failed to start new task
+  }
+  id = FIRST_TASK(free);
+  usedMask |= TASK_BIT(id);
+  kernelUnlock();
+
+  taskList[id].jobID = id;
+  taskList[id].jobPointer = func;
+  taskList[id].jobStatus = RUNABLE;
+  taskList[id].jobDelay = 0;
+  taskList[id].jobPriority = priority;
+  taskList[id].jobState = 0;
+  taskList[id].jobNext = NOTASK;
+  taskList[id].jobPeriod = 0;
+#if MTOS_JITTER
+  taskList[id].jitCount = 0;
+  taskList[id].jitMin = 0;
+  taskList[id].jitMax = 0;
+  taskList[id].jitTotal = 0;
+  taskList[id].jitMissed = 0;
+#endif
+#if MTOS_COROUTINES
+  taskList[id].jobContext = ctx;
+#endif
+  taskList[id].jobCog = numSwitchers > 1 ? id % numSwitchers : 0;
+  taskList[id].evtMask = 0;
+  taskList[id].evtGot = 0;
+#ifdef MTOS_PROFILE
+  taskList[id].prfBudget = 0;
+  taskList[id].prfCalls = 0;
+  taskList[id].prfMin = 0;
+  taskList[id].prfMax = 0;
+  taskList[id].prfTotal = 0;
+  taskList[id].prfOverruns = 0;
+#endif
+  kernelLock();
+  if(ctx)
+    coroutineMask |= TASK_BIT(id);
+  READY(id) |= TASK_BIT(id);
+  kernelUnlock();
+  taskWake();
+  return(id);                                       // Return jobID
 }
 
 /*
@@ -81,16 +724,220 @@ void taskSwitch(void *par){
  *  will add it to the tasklist
  */
 int taskStart( void (*func)(void), int priority){
-  if(nextTask < MAXTASKS){
-    taskList[nextTask].jobID = nextTask;
-    taskList[nextTask].jobPointer = func;
-    taskList[nextTask].jobStatus = RUNABLE;
-    taskList[nextTask].jobDelay = 0;
-    taskList[nextTask].jobPriority = priority;
-    taskList[nextTask].jobState = 0;
-    return(nextTask++);                           // Return jobID & increment for next time.
+  return(taskCreate(func, priority, NULL));
+}
+
+/*
+ *  Remove a task.
+ *  Takes the task off the run queues and sleep list and frees its
+ *  jobID for reuse by a later taskStart(). A task may remove itself;
+ *  a coroutine that does so is never resumed after its next yield.
+ */
+int taskRemove(int id){
+  int sw, pri;
+
+  if(!TASK_VALID(id)) return(-1);
+
+  kernelLock();
+  if(taskList[id].jobStatus == SLEEPING)
+    sleepUnlink(id);
+  taskList[id].jobStatus = HELD;
+  taskList[id].jobPeriod = 0;
+  for(sw = 0; sw < MAXSWITCHERS; sw++){             // Stale passMask bits are skipped
+    for(pri = HIGH_PRI; pri <= LOW_PRI; pri++){     //  by taskDispatch() once the
+      switcher[sw].readyMask[pri] &= ~TASK_BIT(id); //  readyMask bit is gone.
+      switcher[sw].wokeMask[pri]  &= ~TASK_BIT(id);
+    }
+    switcher[sw].timedMask &= ~TASK_BIT(id);
+    switcher[sw].eventMask &= ~TASK_BIT(id);
+  }
+  coroutineMask &= ~TASK_BIT(id);
+  waitMask &= ~TASK_BIT(id);
+  usedMask &= ~TASK_BIT(id);
+  kernelUnlock();
+  return(id);
+}
+
+/*
+ *  Start a new coroutine task.
+ *  Unlike a normal task, a coroutine keeps its place between runs:
+ *  it may loop forever, calling taskYield() or taskWaitUntil() to let
+ *  the other tasks in this cog run. It needs its own stack, declared
+ *  like a cog stack, e.g. unsigned int scan_stack[100];
+ */
+int taskStartCoroutine(void (*func)(void), unsigned int *stack, int stackSize, int priority){
+#if MTOS_COROUTINES
+  struct taskContext *ctx = (struct taskContext *) stack;
+  unsigned int *fill;
+
+  if(stackSize < (int)sizeof(struct taskContext) + MIN_COSTACK)
+    return -1;                                      // Not enough room for context & stack
+  ctx->stackLow = stack + (sizeof(struct taskContext) + 3) / 4;
+  ctx->stackTop = stack + stackSize / 4;
+  ctx->started = 0;
+  ctx->swCount = ctx->swMax = 0;
+  ctx->swTotal = 0;
+  for(fill = ctx->stackLow; fill < ctx->stackTop; fill++)
+    *fill = STACK_FILL;                             // Mark stack unused for high-water check
+  return(taskCreate(func, priority, ctx));
+#else
+  return -1;                                        // Built without coroutine support
+#endif
+}
+
+/* Return the jobID of the task currently running, or NOTASK */
+int taskSelf(void){
+  return(thisSwitcher()->currentTask);
+}
+
+/*
+ *  Yield a coroutine.
+ *  Returns to the task switcher; the coroutine carries on from here
+ *  the next time it is dispatched. Does nothing if called from a
+ *  normal task or from outside the switcher.
+ */
+void taskYield(void){
+#if MTOS_COROUTINES
+  struct switcherStruct *sw = thisSwitcher();
+  int id = sw->currentTask;
+  struct taskContext *ctx;
+
+  if(id == NOTASK || (ctx = taskList[id].jobContext) == NULL)
+    return;
+  if(setjmp(ctx->regs) == 0){
+    ctx->swStart = CNT;
+    longjmp(sw->switchContext, 1);                  // Back to the switcher
+  }
+  recordSwitch(ctx);                                // Resumed by the switcher
+#endif
+}
+
+/*
+ *  Wait until CNT reaches a given time.
+ *  A coroutine sleeps and yields, so other tasks run meanwhile.
+ *  Any other caller simply waits, e.g. taskWaitUntil(CNT + CLKFREQ/50).
+ */
+void taskWaitUntil(unsigned int time){
+#if MTOS_COROUTINES
+  int id = taskSelf();
+
+  if(id != NOTASK && taskList[id].jobContext != NULL){
+    kernelLock();
+    sleepUntil(id, time);
+    kernelUnlock();
+    taskYield();
+    return;
+  }
+#endif
+  while(!releaseDue(time));                         // Plain wait, wrap safe
+}
+
+/*
+ *  Get coroutine statistics.
+ *  Context switch cost in clock ticks (one direction, task to
+ *  switcher or back) and the deepest stack use seen so far.
+ */
+int taskGetCoroutineStats(int id, struct taskCoStats *stats){
+#if MTOS_COROUTINES
+  struct taskContext *ctx;
+  unsigned int *low;
+
+  if(!TASK_VALID(id) || (ctx = taskList[id].jobContext) == NULL)
+    return(-1);
+  for(low = ctx->stackLow; low < ctx->stackTop && *low == STACK_FILL; low++);
+  stats->switches  = ctx->swCount;
+  stats->avgTicks  = ctx->swCount ? (unsigned int)(ctx->swTotal / ctx->swCount) : 0;
+  stats->maxTicks  = ctx->swMax;
+  stats->stackSize = (ctx->stackTop - ctx->stackLow) * 4;
+  stats->stackUsed = (ctx->stackTop - low) * 4;
+  return(stats->stackUsed);
+#else
+  return(-1);
+#endif
+}
+
+/*
+ *  Wait for an event.
+ *  The calling task stops being dispatched until another task or cog
+ *  posts one of the events in mask (one bit per event) with
+ *  taskPostEvent(), so waiting costs nothing per pass. A coroutine
+ *  yields here and gets back the events that released it; a normal
+ *  task returns 0 at once and reads them with taskGetEvents() on its
+ *  next run. Events posted while a task is not waiting are not kept.
+ *  Waiting cancels any period set with taskSetPeriodic().
+ */
+unsigned int taskWaitEvent(unsigned int mask){
+  int id = taskSelf();
+
+  if(id == NOTASK || mask == 0) return(0);
+
+  kernelLock();
+  if(taskList[id].jobStatus == SLEEPING)
+    sleepUnlink(id);
+  READY(id) &= ~TASK_BIT(id);
+  taskList[id].jobStatus = WAITING;
+  taskList[id].jobPeriod = 0;
+  taskList[id].evtMask = mask;
+  taskList[id].evtGot = 0;
+  waitMask |= TASK_BIT(id);
+  kernelUnlock();
+#if MTOS_COROUTINES
+  if(taskList[id].jobContext){
+    taskYield();                                    // Resumed once an event arrives
+    return(taskGetEvents(id));
+  }
+#endif
+  return(0);
+}
+
+/* Return and clear the events that released a task */
+unsigned int taskGetEvents(int id){
+  unsigned int events;
+
+  if(!TASK_VALID(id)) return(0);
+
+  kernelLock();
+  events = taskList[id].evtGot;
+  taskList[id].evtGot = 0;
+  kernelUnlock();
+  return(events);
+}
+
+/*
+ *  Post events.
+ *  Any task Waiting on one of these events is made Runable and is
+ *  dispatched ahead of the rest of its switcher's pass. May be called
+ *  from any task or cog. The time from posting to dispatch is kept
+ *  in the task's release jitter statistics (taskGetJitter).
+ */
+void taskPostEvent(unsigned int events){
+  taskMask waiting;
+  struct switcherStruct *home;
+  int id;
+
+  kernelInit();
+  kernelLock();
+  waiting = waitMask;
+  while(waiting){
+    id = FIRST_TASK(waiting);
+    waiting &= ~TASK_BIT(id);
+    if(taskList[id].jobStatus != WAITING){
+      waitMask &= ~TASK_BIT(id);                    // Status changed since it began waiting
+      continue;
+    }
+    if((taskList[id].evtMask & events) == 0)
+      continue;
+    waitMask &= ~TASK_BIT(id);
+    taskList[id].evtGot |= taskList[id].evtMask & events;
+    taskList[id].jobStatus = RUNABLE;
+    taskList[id].jobDelay = CNT;                    // Released now, for the jitter sample
+    home = &switcher[taskList[id].jobCog];
+    home->readyMask[taskList[id].jobPriority] |= TASK_BIT(id);
+    home->eventMask |= TASK_BIT(id);
+    home->timedMask |= TASK_BIT(id);
   }
-  return -1;                                      // Return - failed to start new task
+  kernelUnlock();
+  taskWake();
 }
 
 /*
@@ -98,20 +945,100 @@ int taskStart( void (*func)(void), int priority){
  *  Pass the job ID of teh task along with a value
  *  of zero to Hold the job or a positive number of milliseconds
  *  to delay "sleep" the task before running again.
+ *  Holding a periodic task also cancels its period.
  */
 int taskSetStatus(int id, int value){
-  switch(value){
-    case HELD:
-      taskList[id].jobStatus = HELD;
-      break;
-    case RUNABLE:
-      taskList[id].jobStatus = RUNABLE;
-      break;
-    default:
-      taskList[id].jobStatus = SLEEPING;
-      taskList[id].jobDelay = CNT+(CLKFREQ*(value/1000));
-      break;
+  if(!TASK_VALID(id)) return(-1);
+
+  if(value != HELD && value != RUNABLE)
+    return(taskSleepMs(id, value));
+
+  kernelLock();
+  if(taskList[id].jobStatus == SLEEPING)
+    sleepUnlink(id);
+  if(value == HELD){
+    taskList[id].jobStatus = HELD;
+    taskList[id].jobPeriod = 0;
+    READY(id) &= ~TASK_BIT(id);
+  } else {
+    taskList[id].jobStatus = RUNABLE;
+    READY(id) |= TASK_BIT(id);
+  }
+  kernelUnlock();
+  taskWake();
+  return(taskList[id].jobStatus);
+}
+
+/*
+ *  Sleep a task for a number of milliseconds or microseconds.
+ *  Delays are measured in clock ticks, so sub-second (and sub-
+ *  millisecond) sleeps are honoured, and the wake-up test is safe
+ *  across CNT roll-over. Delays are limited to 2^31 ticks.
+ */
+int taskSleepMs(int id, int ms){
+  if(!TASK_VALID(id) || ms < 0) return(-1);
+
+  kernelLock();
+  sleepUntil(id, CNT + sleepTicks(ms, 1000));
+  kernelUnlock();
+  taskWake();
+  return(SLEEPING);
+}
+
+int taskSleepUs(int id, int us){
+  if(!TASK_VALID(id) || us < 0) return(-1);
+
+  kernelLock();
+  sleepUntil(id, CNT + sleepTicks(us, 1000000));
+  kernelUnlock();
+  taskWake();
+  return(SLEEPING);
+}
+
+/*
+ *  Make a task periodic.
+ *  The task is released every periodUs microseconds, starting one
+ *  period from now, with each release computed from the previous
+ *  one so the schedule does not drift. A period of zero returns the
+ *  task to an ordinary Runable task.
+ */
+int taskSetPeriodic(int id, int periodUs){
+  if(!TASK_VALID(id) || periodUs < 0) return(-1);
+
+  kernelLock();
+  taskList[id].jobPeriod = sleepTicks(periodUs, 1000000);
+  if(taskList[id].jobPeriod){
+    sleepUntil(id, CNT + taskList[id].jobPeriod);
+  } else if(taskList[id].jobStatus == SLEEPING){
+    sleepUnlink(id);
+    taskList[id].jobStatus = RUNABLE;
+    READY(id) |= TASK_BIT(id);
   }
+  kernelUnlock();
+  taskWake();
+  return(periodUs);
+}
+
+/*
+ *  Get task release jitter.
+ *  Fills in the latency between each timed release (sleep expiry
+ *  or periodic release) and the task actually being dispatched.
+ *  Values are in clock ticks; divide by CLKFREQ/1000000 for us.
+ */
+int taskGetJitter(int id, struct taskJitter *stats){
+#if MTOS_JITTER
+  if(!TASK_VALID(id)) return(-1);
+
+  stats->releases = taskList[id].jitCount;
+  stats->minTicks = taskList[id].jitMin;
+  stats->maxTicks = taskList[id].jitMax;
+  stats->avgTicks = taskList[id].jitCount ?
+                    (unsigned int)(taskList[id].jitTotal / taskList[id].jitCount) : 0;
+  stats->missed   = taskList[id].jitMissed;
+  return(stats->releases);
+#else
+  return(-1);                                       // Built without jitter statistics
+#endif
 }
 
 /*
@@ -121,8 +1048,16 @@ int taskSetStatus(int id, int value){
  *  Default priority is Normal.
  */
 int taskSetPriority(int id, int value){
-  if (value <= LOW_PRI) { 
+  if(!TASK_VALID(id)) return(-1);
+  if (value >= HIGH_PRI && value <= LOW_PRI) { 
+    kernelLock();
+    if(READY(id) & TASK_BIT(id)){                   // Move Runable task to its
+      READY(id) &= ~TASK_BIT(id);                   //  new priority bitmap.
+      switcher[taskList[id].jobCog].readyMask[value] |= TASK_BIT(id);
+    }
     taskList[id].jobPriority = value;
+    kernelUnlock();
+    taskWake();
   } else
     return (-1);
   return(value);
@@ -141,7 +1076,7 @@ void taskSetState(int id, int value){
 /*
  *  Get task Status.
  *  Will return the current value of a given tasks Status.
- *    0=Held, 1=Runable, 2=Sleeping
+ *    0=Held, 1=Runable, 2=Sleeping, 3=Waiting
  */
 int   taskGetStatus(int id){
   return(taskList[id].jobStatus);
@@ -163,4 +1098,73 @@ int   taskGetPriority(int id){
  */
 int   taskGetState(int id){
   return(taskList[id].jobState);
-}
\ No newline at end of file
+}
+
+#ifdef MTOS_PROFILE
+/*
+ *  Set task time budget.
+ *  Any run (or coroutine slice) longer than budgetUs microseconds
+ *  is counted as an overrun. Zero removes the budget.
+ */
+int taskSetBudget(int id, int budgetUs){
+  if(!TASK_VALID(id) || budgetUs < 0) return(-1);
+  taskList[id].prfBudget = budgetUs * (CLKFREQ / 1000000);
+  return(budgetUs);
+}
+
+/* Copy one task's profile */
+static void copyStats(int id, struct taskStats *stats){
+  stats->calls    = taskList[id].prfCalls;
+  stats->minTicks = taskList[id].prfMin;
+  stats->maxTicks = taskList[id].prfMax;
+  stats->avgTicks = taskList[id].prfCalls ?
+                    (unsigned int)(taskList[id].prfTotal / taskList[id].prfCalls) : 0;
+  stats->overruns = taskList[id].prfOverruns;
+}
+
+/*
+ *  Get task execution profile.
+ *  Run counts and times in clock ticks, measured around each
+ *  dispatch of the task.
+ */
+int taskGetStats(int id, struct taskStats *stats){
+  if(!TASK_VALID(id)) return(-1);
+  copyStats(id, stats);
+  return(stats->calls);
+}
+
+/* Send a long least significant byte first */
+static void dumpLong(serial *port, unsigned int value){
+  writeChar(port, value);
+  writeChar(port, value >> 8);
+  writeChar(port, value >> 16);
+  writeChar(port, value >> 24);
+}
+
+/*
+ *  Dump all task profiles as one binary frame.
+ *  Frame: 0xA5 0x5A, task count, then per task: jobID, calls,
+ *  min, avg, max ticks and overruns (each a little endian long).
+ *  The tasks are those in use when the dump starts, so the count
+ *  matches the entries sent even if tasks come and go meanwhile.
+ */
+void taskDumpStats(serial *port){
+  struct taskStats stats;
+  taskMask tasks = usedMask;
+  int id;
+
+  writeChar(port, 0xA5);
+  writeChar(port, 0x5A);
+  writeChar(port, COUNT_TASKS(tasks));
+  for(id = 0; id < MAXTASKS; id++){
+    if(!(tasks & TASK_BIT(id))) continue;           // Free when the dump started
+    copyStats(id, &stats);
+    writeChar(port, id);
+    dumpLong(port, stats.calls);
+    dumpLong(port, stats.minTicks);
+    dumpLong(port, stats.avgTicks);
+    dumpLong(port, stats.maxTicks);
+    dumpLong(port, stats.overruns);
+  }
+}
+#endif
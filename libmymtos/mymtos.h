@@ -13,6 +13,8 @@
  *    - All tasks (functions) run to completion before yielding
  *    - A function must provide for external state determination
  *      if it runs longer than a single iteration
+ *    - Optional coroutine tasks keep their own stack and may
+ *      yield part way through with taskYield()/taskWaitUntil()
  */
 
 #ifndef MYMTOS_H
@@ -22,11 +24,42 @@
 extern "C" {
 #endif
 
-#define MAXTASKS 10
+#include "robot_defs.h"                             // Common cmd_struct definition
+
+#ifndef MAXTASKS
+#define MAXTASKS 10                                 // Override with -DMAXTASKS=n (up to 64)
+#endif
+
+#ifndef MAXSWITCHERS
+#define MAXSWITCHERS 1                              // Task switcher cogs, override with -D
+#endif
+
+#ifndef MTOS_IDLE_US
+#define MTOS_IDLE_US 100                            // Idle switcher checks for wake events this often
+#endif
+
+#ifndef MTOS_STACK
+#define MTOS_STACK (160 + (50 * 4))                 // Stack longs per switcher cog
+#endif
+
+#ifndef MTOS_JITTER
+#define MTOS_JITTER 1                               // 0 leaves out release jitter statistics
+#endif
+
+#ifndef MTOS_COROUTINES
+#define MTOS_COROUTINES 1                           // 0 leaves out coroutine task support
+#endif
+
+#ifndef MTOS_HUB_BUDGET
+#define MTOS_HUB_BUDGET 12288                       // Most hub RAM (bytes) the kernel tables may use
+#endif
+
+#define NOTASK    -1                                // No task ready to run
 
 #define HELD      0
 #define RUNABLE   1
 #define SLEEPING  2
+#define WAITING   3                                 // Waiting for an event (taskWaitEvent)
 
 
 //Priority classes
@@ -34,16 +67,124 @@ extern "C" {
 #define NORMAL_PRI  2
 #define HIGH_PRI    1
 
+// Release jitter statistics (clock ticks) returned by taskGetJitter()
+struct taskJitter {
+  int           releases;                           // Timed releases measured
+  unsigned int  minTicks;                           // Best case release latency
+  unsigned int  maxTicks;                           // Worst case release latency
+  unsigned int  avgTicks;                           // Average release latency
+  int           missed;                             // Periodic releases skipped (overruns)
+};
+
+// Coroutine statistics returned by taskGetCoroutineStats()
+struct taskCoStats {
+  unsigned int  switches;                           // Context switches measured
+  unsigned int  avgTicks;                           // Average context switch cost
+  unsigned int  maxTicks;                           // Worst case context switch cost
+  int           stackSize;                          // Usable stack in bytes
+  int           stackUsed;                          // Stack high-water mark in bytes
+};
+
+// Switcher load returned by taskGetLoad()
+struct taskLoad {
+  unsigned long long busyTicks;                     // Ticks spent running tasks
+  unsigned long long idleTicks;                     // Ticks spent idle in waitcnt
+  int           busyPercent;                        // Busy share of busy + idle
+};
+
+#ifdef MTOS_PROFILE
+#include "serial.h"
+
+// Task execution profile returned by taskGetStats() (build with -DMTOS_PROFILE)
+struct taskStats {
+  unsigned int  calls;                              // Times the task was run
+  unsigned int  minTicks;                           // Shortest run
+  unsigned int  avgTicks;                           // Average run
+  unsigned int  maxTicks;                           // Longest run
+  unsigned int  overruns;                           // Runs over the task's budget
+};
+#endif
+
+#ifndef MBOX_SIZE
+#define MBOX_SIZE   8                               // Commands per mailbox (power of 2)
+#endif
+
+// Single producer / single consumer command mailbox
+struct mailbox {
+  volatile unsigned int head;                       // Commands pushed (producer only)
+  volatile unsigned int tail;                       // Commands popped (consumer only)
+  struct cmd_struct slot[MBOX_SIZE];                // Command ring
+};
+
+#ifndef MTOS_WATCHERS
+#define MTOS_WATCHERS 2                             // Pin edge watcher cogs (taskWatchPin)
+#endif
+
+// Pin edges for taskWatchPin()
+#define EDGE_RISE   1
+#define EDGE_FALL   2
+#define EDGE_BOTH   3
+
+#define MAXBEHAVIORS 32                             // Arbiter levels (bits in one long)
+
+// Arbiter state returned by arbGetStats()
+struct arbStats {
+  int           winner;                             // Level of the last command forwarded
+  unsigned int  activeMask;                         // Levels currently proposing
+  unsigned int  forwarded;                          // Commands sent to the output
+  unsigned int  suppressed;                         // Repeated commands not sent
+};
+
+#define MIN_COSTACK 160                             // Smallest coroutine stack in bytes
+
 int   initTaskSwitcher(void);
+int   initTaskSwitchers(int cogs);
 void  taskSwitch(void *par);
+int   taskDispatch(void);
+void  taskWake(void);
+int   taskGetLoad(int sw, struct taskLoad *load);
 int   taskStart( void (*func)(void), int priority=NORMAL_PRI);
+int   taskRemove(int id);
+int   taskStartCoroutine(void (*func)(void), unsigned int *stack, int stackSize,
+                         int priority=NORMAL_PRI);
+int   taskSelf(void);
+void  taskYield(void);
+void  taskWaitUntil(unsigned int time);
 int   taskSetStatus(int id, int value);
+int   taskSleepMs(int id, int ms);
+int   taskSleepUs(int id, int us);
+int   taskSetPeriodic(int id, int periodUs);
+int   taskGetJitter(int id, struct taskJitter *stats);
+int   taskGetCoroutineStats(int id, struct taskCoStats *stats);
+unsigned int taskWaitEvent(unsigned int mask);
+unsigned int taskGetEvents(int id);
+void  taskPostEvent(unsigned int events);
+int   taskWatchPin(int pin, int edge, unsigned int events);
+#ifdef MTOS_PROFILE
+int   taskSetBudget(int id, int budgetUs);
+int   taskGetStats(int id, struct taskStats *stats);
+void  taskDumpStats(serial *port);
+#endif
 int   taskSetPriority(int id, int value);
 void  taskSetState(int id, int value);
 int   taskGetStatus(int id);
 int   taskGetPriority(int id);
 int   taskGetState(int id);
 
+void  mboxInit(struct mailbox *mb);
+int   mboxCount(struct mailbox *mb);
+int   mboxPush(struct mailbox *mb, struct cmd_struct cmd);
+int   mboxPop(struct mailbox *mb, struct cmd_struct *cmd);
+int   mboxWait(struct mailbox *mb, struct cmd_struct *cmd, int timeoutMs=0);
+
+void  arbInit(struct cmd_struct (*output)(struct cmd_struct cmd));
+int   arbAddBehavior(int level);
+int   arbPropose(int level, struct cmd_struct cmd);
+int   arbRelease(int level);
+int   arbitrate(void);
+int   arbStart(int periodUs);
+int   arbGetStats(struct arbStats *stats);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,43 @@
+/*
+ *  simpletools.h stand in for the mymtos host build (host only).
+ *  Just the Propeller features mymtos and its benchmark use. Threads
+ *  stand in for cogs and CNT counts at CLKFREQ from the host clock,
+ *  so the MTOS_BENCH figures come out in real Propeller units, only
+ *  for a much faster "cog". See mtossim.cpp.
+ */
+
+#ifndef SIMPLETOOLS_H
+#define SIMPLETOOLS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+extern unsigned int _clkfreq;
+
+unsigned int sim_cnt(void);                       // CNT from the host clock
+void  sim_waitcnt(unsigned int until);            // Sleep until CNT reaches until
+
+#define CNT         sim_cnt()
+#define CLKFREQ     _clkfreq
+#define waitcnt(t)  sim_waitcnt(t)
+
+int   cogstart(void (*func)(void *), void *par, void *stack, size_t stacksize);
+int   cogid(void);
+void  cogstop(int id);                            // Only a cog stopping itself
+int   locknew(void);
+void  lockret(int lock);
+int   lockset(int lock);
+int   lockclr(int lock);
+void  pause(int ms);
+int   print(const char *format, ...);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif
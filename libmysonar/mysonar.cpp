@@ -7,6 +7,11 @@
 
 #include  "mysonar.h"
 #include  "servo.h"
+#ifdef DRIVE_COG
+#include  "mydrive.h"                       // Head pulses sent by the motor cog instead
+#define servo_set     drive_set             // Same pins & units as the servo library
+#define servo_angle   drive_angle
+#endif
 #include  "ping.h"
 #include  "robot_defs.h"
 #include  "simpletools.h"
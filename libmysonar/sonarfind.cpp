@@ -7,6 +7,7 @@
 #include  "ping.h"
 #include  "robot_defs.h"
 #include  "simpletools.h"
+#include  "mytrig.h"
 
 
 
@@ -14,25 +15,28 @@
 int sonarFindTarget(int type){
   int   leftEdge  = 180;                  // Angle in degrees to left edge of object.
   int   rightEdge = 0;                    // Angle in degrees to right edge of object.
-  float hAngle    = 0.0;                  // Angle head needs to face for center of object.
-  float num       = 0.0;                  // Numerator
-  float den       = 0.0;                  // Denominator
-  float rAngle    = 0.0;                  // Angle robot needs to face to point at center of object.
+  int   hAngle    = 0;                    // Angle head needs to face for center of object.
+  int   num       = 0;                    // Numerator (scaled by TRIG_ONE)
+  int   den       = 0;                    // Denominator (scaled by TRIG_ONE)
+  int   rAngle    = 0;                    // Angle robot needs to face to point at center of object.
   
   leftEdge = findLeftEdge(type);          // Find the left edge of the object.
   rightEdge = findRightEdge(type);        // Find the right edge of the object.
   
   hAngle = ((leftEdge + rightEdge) / 2);  // Angle for center of the object (head perspective).
-  sonarPointAt((int) hAngle);             // Turn head toward center of object.
+  sonarPointAt(hAngle);                   // Turn head toward center of object.
                                           //  and confirm distance to target.
   
-  num = ((pingDist * sin(hAngle*PI/180)) + 6.5); // Establish the numerator of our trig calculation.
-  den = (pingDist * cos(hAngle*PI/180));  // Establish the denominator of the triq calculation.
-  rAngle = num / den;                     // Divide the numerator by the denominator.
-  rAngle = atan(rAngle)*180/PI;           // Determine the ArcTan of the resulting angle.
+  num = pingDist * isin(hAngle) + (int)(6.5 * TRIG_ONE); // Establish the numerator of our trig calculation.
+  den = pingDist * icos(hAngle);          // Establish the denominator of the triq calculation.
+  if(den < 0){                            // ArcTan of num / den, so keep the
+    num = -num;                           //  angle within +/- 90 degrees.
+    den = -den;
+  }
+  rAngle = iatan2(num, den);              // Determine the ArcTan of the resulting angle.
   if(rAngle > 0) rAngle = 90 - rAngle;    // If angle positive turn right 90-angle degrees.
   if(rAngle < 0) rAngle = -1 * (90 + rAngle); // If negative, turn left 90-angle degrees.
-  return((int) rAngle);                   // Return integer value of rAngle.
+  return(rAngle);                         // Return integer value of rAngle.
 }  
 
 /* Find the left edge of either the closest or farthest object */
@@ -0,0 +1,58 @@
+/*
+ *  MyTrig test harness and benchmark.
+ *
+ *  Prints the largest error of isin()/icos() (in 1/TRIG_ONE) and of
+ *  iatan2() (in degrees) against the float math library, and the
+ *  average clock cycles per call of each against sin() and atan2().
+ */
+
+#include  "mytrig.h"
+#include  "robot_defs.h"
+#include  "simpletools.h"
+
+#define BENCH_CALLS 360
+
+volatile int    iSink;                          // Keep results live
+volatile float  fSink;
+
+int main(){
+  unsigned int start, iCycles, fCycles;
+  float err, maxSin = 0.0, maxAtan = 0.0;
+  int   deg, x, y;
+
+  for(deg = 0; deg < 360; deg++){               // Table error over a full turn
+    err = fabs(isin(deg) - TRIG_ONE * sin(deg * PI/180));
+    if(err > maxSin) maxSin = err;
+    err = fabs(icos(deg) - TRIG_ONE * cos(deg * PI/180));
+    if(err > maxSin) maxSin = err;
+  }
+  for(y = -200; y <= 200; y += 7){              // atan2 error over a grid of points
+    for(x = -200; x <= 200; x += 11){
+      err = fabs(iatan2(y, x) - atan2(y, x) * 180/PI);
+      if(err > 180) err = 360 - err;
+      if(err > maxAtan) maxAtan = err;
+    }
+  }
+  print("isin/icos max error %f LSB\n", maxSin);
+  print("iatan2 max error %f degrees\n", maxAtan);
+
+  start = CNT;
+  for(deg = 0; deg < BENCH_CALLS; deg++)
+    iSink = isin(deg);
+  iCycles = (CNT - start) / BENCH_CALLS;
+  start = CNT;
+  for(deg = 0; deg < BENCH_CALLS; deg++)
+    fSink = sin(deg * PI/180);
+  fCycles = (CNT - start) / BENCH_CALLS;
+  print("isin   %d cycles, sin   %d cycles\n", iCycles, fCycles);
+
+  start = CNT;
+  for(deg = 0; deg < BENCH_CALLS; deg++)
+    iSink = iatan2(deg - 180, 97);
+  iCycles = (CNT - start) / BENCH_CALLS;
+  start = CNT;
+  for(deg = 0; deg < BENCH_CALLS; deg++)
+    fSink = atan2(deg - 180, 97) * 180/PI;
+  fCycles = (CNT - start) / BENCH_CALLS;
+  print("iatan2 %d cycles, atan2 %d cycles\n", iCycles, fCycles);
+}
@@ -0,0 +1,74 @@
+/*
+ *  MyTrig - whole degree lookup table trigonometry.
+ *
+ *  isin()/icos() are exact to the nearest 1/TRIG_ONE. iatan2() linearly
+ *  interpolates a 1/32 step arctangent table, which is good to about
+ *  0.01 degree before rounding to whole degrees.
+ */
+
+#include  "mytrig.h"
+
+// sin(0..90 degrees) * 32767
+static const short sineTable[91] = {
+      0,   572,  1144,  1715,  2286,  2856,  3425,  3993,  4560,  5126,
+   5690,  6252,  6813,  7371,  7927,  8481,  9032,  9580, 10126, 10668,
+  11207, 11743, 12275, 12803, 13328, 13848, 14364, 14876, 15383, 15886,
+  16383, 16876, 17364, 17846, 18323, 18794, 19260, 19720, 20173, 20621,
+  21062, 21497, 21925, 22347, 22762, 23170, 23571, 23964, 24351, 24730,
+  25101, 25465, 25821, 26169, 26509, 26841, 27165, 27481, 27788, 28087,
+  28377, 28659, 28932, 29196, 29451, 29697, 29934, 30162, 30381, 30591,
+  30791, 30982, 31163, 31335, 31498, 31650, 31794, 31927, 32051, 32165,
+  32269, 32364, 32448, 32523, 32587, 32642, 32687, 32722, 32747, 32762,
+  32767
+};
+
+// atan(i / 32) in 1/256 degrees, i = 0..32
+static const unsigned short atanTable[33] = {
+      0,   458,   916,  1371,  1824,  2273,  2719,  3159,  3593,  4021,
+   4443,  4856,  5262,  5660,  6049,  6429,  6801,  7163,  7516,  7859,
+   8193,  8518,  8834,  9141,  9439,  9728, 10008, 10280, 10544, 10799,
+  11047, 11287, 11520
+};
+
+/* Sine of a whole number of degrees, scaled by TRIG_ONE */
+int isin(int deg){
+  deg %= 360;
+  if(deg < 0) deg += 360;
+  if(deg <= 90)  return(sineTable[deg]);
+  if(deg <= 180) return(sineTable[180 - deg]);
+  if(deg <= 270) return(-sineTable[deg - 180]);
+  return(-sineTable[360 - deg]);
+}
+
+/* Cosine of a whole number of degrees, scaled by TRIG_ONE */
+int icos(int deg){
+  return(isin(deg + 90));
+}
+
+/* Angle of the point (x, y) from the x axis in whole degrees, -180 to 180 */
+int iatan2(int y, int x){
+  unsigned int ax = x < 0 ? 0u - x : x;
+  unsigned int ay = y < 0 ? 0u - y : y;
+  unsigned int lo, hi, ratio, i, frac;
+  int   angle;                              // In 1/256 degrees
+
+  if(ax == 0 && ay == 0)
+    return(0);
+  hi = ax > ay ? ax : ay;
+  lo = ax > ay ? ay : ax;
+  while(hi >= 0x10000){                     // Keep lo << 16 within 32 bits
+    hi >>= 1;
+    lo >>= 1;
+  }
+  ratio = (lo << 16) / hi;                  // tan of the first octant angle, 0..1 in Q16
+  i = ratio >> 11;                          // Table step (1/32)
+  frac = ratio & 0x7FF;
+  angle = atanTable[i];
+  if(i < 32)
+    angle += ((atanTable[i + 1] - atanTable[i]) * frac) >> 11;
+
+  if(ay > ax) angle = 90 * 256 - angle;     // Unfold the octants
+  if(x < 0)   angle = 180 * 256 - angle;
+  if(y < 0)   angle = -angle;
+  return(angle >= 0 ? (angle + 128) >> 8 : -((-angle + 128) >> 8));
+}
@@ -0,0 +1,30 @@
+/*
+ *  @file mytrig.h
+ *
+ *  @brief MyTrig - whole degree lookup table trigonometry
+ *
+ *  Sine and cosine of whole degrees from a quarter wave table and an
+ *  integer atan2, so control loops can avoid the floating point math
+ *  library. Sines are scaled by TRIG_ONE (Q15).
+ */
+
+#ifndef MYTRIG_H
+#define MYTRIG_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define TRIG_ONE    32767                   // isin()/icos() value for 1.0
+
+// Trig function prototypes
+int   isin(int deg);                        // Sine of whole degrees * TRIG_ONE
+int   icos(int deg);                        // Cosine of whole degrees * TRIG_ONE
+int   iatan2(int y, int x);                 // Angle of (x, y) in whole degrees (-180 to 180)
+
+#if defined(__cplusplus)
+}
+#endif
+/* __cplusplus */  
+#endif
+/* MYTRIG_H */  
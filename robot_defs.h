@@ -52,6 +52,10 @@ extern "C" {
 #define MODE	23							// Set motor mode (PI, PD, PID, etc)
 #define SETPOS	24							// Set GPS location to specific values
 #define GETPOS	25							// Get current GPS location
+#define GOTO	26							// Drive to an x-y waypoint (speed in direction)
+#define TUNE	27							// Tune motor control gains
+#define FFCAL	28							// Calibrate motor feed forward tables
+#define STALL	29							// Status: a wheel stalled or slipped, wheels stopped
 
 // Sonar Handler Action words
 #define	SWEEP	30							// Continuous pass over defined area for objects
@@ -94,6 +98,12 @@ extern "C" {
 #define	_EE_CMPS_ID		0				// Address offset to Compass Calibration ID string.
 #define _EE_CMPS_XCAL	10				// Address offset to Compass X-axis calibration value.
 #define	_EE_CMPS_YCAL	15				// Address offset to Compass Y-axis calibration value.
+#define	_EE_MTR_ID		20				// Address offset to Motor gains ID string.
+#define _EE_MTR_KPRO	25				// Address offset to Motor proportional gain (1/1000).
+#define _EE_MTR_KINT	30				// Address offset to Motor integral gain (1/1000).
+#define _EE_MTR_KDRV	35				// Address offset to Motor derivative gain (1/1000).
+#define	_EE_FF_ID		40				// Address offset to Motor feed forward ID string.
+#define _EE_FF_TABLE	45				// Address offset to Motor feed forward tables (44 ints).
 
 /*
  * @brief Common command structure used for sub-system communication